@@ -46,6 +46,18 @@ class AssertionError : public std::exception {
 };
 }
 
+//AASSERT5 is reserved for expensive consistency checks (such as FutureId lookups on each Future copy)
+//  NOT enabled by default; debug builds MAY use -DAASSERT_LVL=5
+#if AASSERT_LVL >= 5
+#ifdef __GNUC__
+#define AASSERT5(cond,...) (void)( !!(cond) || ( throw autom::AssertionError( #cond, __FILE__, __LINE__, ## __VA_ARGS__ ), 0 ) )
+#else
+#define AASSERT5(cond,...) (void)( !!(cond) || ( throw autom::AssertionError( #cond, __FILE__, __LINE__, __VA_ARGS__ ), 0 ) )
+#endif
+#else
+#define AASSERT5(cond,...) ((void)0)
+#endif
+
 #if AASSERT_LVL >= 4
 #ifdef __GNUC__
 #define AASSERT4(cond,...) (void)( !!(cond) || ( throw autom::AssertionError( #cond, __FILE__, __LINE__, ## __VA_ARGS__ ), 0 ) )
@@ -18,16 +18,72 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <utility>
 #include <string>
 
+#include "aerror.h"
+#include "../libsrc/infra/bufferpool.h"
+
 namespace autom {
 
-class NetworkBuffer : public std::string {};
+//Bytes received from the network, right in the receive buffer libuv has read them into (see InfraBufferPool)
+//  copies share the buffer (refcounted), so the bytes are never copied on their way from the socket to Buffer
+//  NB: always followed by '\0'; MUST NOT outlive the LoopContainer it comes from
+class NetworkBuffer {
+    const char* p = nullptr;//we hold a reference
+    size_t sz = 0;
+
+  public:
+    NetworkBuffer() {}
+    //Takes over the reference returned by InfraBufferPool::allocate()
+    NetworkBuffer( const char* p_, size_t sz_ ) : p( p_ ), sz( sz_ ) {}
+    NetworkBuffer( const NetworkBuffer& other ) : p( other.p ), sz( other.sz ) {
+        if( p )
+            InfraBufferPool::addRef( p );
+    }
+    NetworkBuffer( NetworkBuffer&& other ) : p( other.p ), sz( other.sz ) {
+        other.p = nullptr;
+        other.sz = 0;
+    }
+    NetworkBuffer& operator=( const NetworkBuffer& other ) {
+        NetworkBuffer tmp( other );
+        return *this = std::move( tmp );
+    }
+    NetworkBuffer& operator=( NetworkBuffer&& other ) {
+        if( this != &other ) {
+            InfraBufferPool::release( p );
+            p = other.p;
+            sz = other.sz;
+            other.p = nullptr;
+            other.sz = 0;
+        }
+        return *this;
+    }
+    ~NetworkBuffer() {
+        InfraBufferPool::release( p );
+    }
+
+    const char* data() const {
+        return p ? p : "";
+    }
+    const char* c_str() const {
+        return data();
+    }
+    size_t size() const {
+        return sz;
+    }
+    bool empty() const {
+        return sz == 0;
+    }
+};
 
 class Buffer {
+    NetworkBuffer received;//see fromNetwork()
     std::string s;
 
   public:
     const char* toString() const {
-        return s.c_str();
+        return received.empty() ? s.c_str() : received.c_str();
+    }
+    size_t size() const {
+        return received.empty() ? s.size() : received.size();
     }
 
     Buffer() {}
@@ -37,7 +93,9 @@ class Buffer {
     Buffer& operator=( const Buffer& ) = default;
     Buffer& operator=( Buffer&& ) = default;
 
-    std::exception* fromNetwork( const NetworkBuffer& b );
+    //Shares b (no bytes are copied)
+    //  returns nullptr if b is fine; otherwise, one of ErrorStatus::get(), which goes to continuations as it is
+    const ErrorStatus* fromNetwork( const NetworkBuffer& b );
 };
 }
 #endif
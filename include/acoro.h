@@ -0,0 +1,229 @@
+/*******************************************************************************
+Copyright (C) 2016 OLogN Technologies AG
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*******************************************************************************/
+
+#ifndef ACORO_H
+#define ACORO_H
+
+//NB: compiler coroutines are an alternative to CCode (see ccode.h) where they're supported;
+//    ACORO_ENABLED is defined if they are, otherwise this header is empty
+#if defined( __cpp_impl_coroutine ) && defined( __has_include )
+#if __has_include( <coroutine> )
+#include <coroutine>
+#define ACORO_ENABLED
+#define ACORO_NAMESPACE std
+namespace autom {
+namespace coro = std;
+}
+#endif
+#elif defined( __cpp_coroutines ) && defined( __has_include )
+#if __has_include( <experimental/coroutine> )
+#include <experimental/coroutine>
+#define ACORO_ENABLED
+#define ACORO_NAMESPACE std::experimental
+namespace autom {
+namespace coro = std::experimental;
+}
+#endif
+#endif
+
+#ifdef ACORO_ENABLED
+
+#include <stdexcept>
+#include <type_traits>
+
+#include "aassert.h"
+#include "aerror.h"
+#include "anode.h"
+#include "future.h"
+#include "../libsrc/infra/infraconsole.h"
+
+namespace autom {
+
+//Return type of a coroutine handler, which MAY co_await Future<T> and MultiFuture<T>
+//  same as CCode, it starts right away and runs until the first future which is not ready yet;
+//  it is resumed from the future's continuation, i.e. from within Node's event processing,
+//  so steps between co_await's run in the very same order as the corresponding CCode steps would
+//  frame is allocated from Node's framePool if the coroutine is a member function of Node,
+//  or a function with Node* as its first parameter; otherwise, from the global heap
+//  NB: the frame is gone as soon as the coroutine is over, and there is nothing to wait for in CoTask itself
+class CoTask {
+  public:
+    //Promise of a coroutine which has nothing to do with a Node: its frame comes from the global heap
+    struct promise_type {
+        //Allocated frame is preceded by the Node* whose framePool it came from (nullptr for the global heap)
+        static const size_t HEADER = InfraFuturePool::GRANULARITY;
+        static_assert( HEADER >= sizeof( Node* ), "Node* MUST fit into CoTask frame header" );
+
+        static void* allocate( Node* node, size_t sz ) {
+            void* p = node ? node->infraFramePool().allocate( sz + HEADER ) : ::operator new( sz + HEADER );
+            *static_cast< Node** >( p ) = node;
+            return static_cast< char* >( p ) + HEADER;
+        }
+        static void deallocate( void* p, size_t sz ) {
+            void* block = static_cast< char* >( p ) - HEADER;
+            Node* node = *static_cast< Node** >( block );
+            if( node )
+                node->infraFramePool().deallocate( block, sz + HEADER );
+            else
+                ::operator delete( block );
+        }
+        static void* operator new( size_t sz ) {
+            return allocate( nullptr, sz );
+        }
+        static void operator delete( void* p, size_t sz ) {
+            deallocate( p, sz );
+        }
+
+        CoTask get_return_object() {
+            return CoTask();
+        }
+        coro::suspend_never initial_suspend() noexcept {
+            return {};
+        }
+        coro::suspend_never final_suspend() noexcept {
+            return {};
+        }
+        void return_void() {}
+        //NB: same as CCode code outside of TTRY, the coroutine is just over
+        void unhandled_exception() {
+            INFRATRACE4( "CoTask: dropped after unhandled exception" );
+        }
+    };
+};
+
+//Promise of a coroutine whose first parameter is Node* or Node& (or of a class derived from Node, such as 'this' of Node's member):
+//  its frame comes from Node's framePool (see coroutine_traits below, which pick it by coroutine's parameters)
+//  NB: operator new is not a template itself, so that the compiler sees it matching operator delete (-Wmismatched-new-delete)
+template< typename First, typename... Args >
+struct CoTaskNodePromise : CoTask::promise_type {
+    static void* operator new( size_t sz, First first, Args& ... ) {
+        return allocate( nodeOf( first ), sz );
+    }
+    static void operator delete( void* p, size_t sz ) {
+        deallocate( p, sz );
+    }
+
+  private:
+    static Node* nodeOf( Node* node ) {
+        return node;
+    }
+    static Node* nodeOf( Node& node ) {
+        return &node;
+    }
+};
+
+template< typename N >
+struct CoTaskIsNode : std::integral_constant < bool, std::is_base_of< Node, N >::value && !std::is_const< N >::value > {};
+
+//Exception of a future, as thrown from co_await; ErrorStatus goes as it is (without allocating a message)
+[[noreturn]] inline void infraRethrow( const std::exception& x ) {
+    if( errorCode( x ) )
+        throw static_cast< const ErrorStatus& >( x );
+    throw std::runtime_error( x.what() );
+}
+
+//Continuation of a future, resuming the coroutine waiting for it
+//  exception (if any) is valid only within the continuation, so the coroutine MUST be resumed right here
+struct CoResume {
+    coro::coroutine_handle<> h;
+    const std::exception** ex;
+
+    CoResume( coro::coroutine_handle<> h_, const std::exception** ex_ ) : h( h_ ), ex( ex_ ) {}
+    void operator()( const std::exception* x ) {
+        *ex = x;
+        h.resume();
+        //NB: MUST NOT touch anything here, the coroutine (together with the awaiter) MAY be gone
+    }
+};
+
+//co_await Future<T> (or SharedFuture<T>): returns value() once the future is ready; rethrows the future's exception (see infraRethrow())
+//  we hold a reference to the future while waiting
+template< typename F >
+class FutureAwaiter {
+    F future;
+    const std::exception* ex = nullptr;
+
+  public:
+    explicit FutureAwaiter( const F& f ) : future( f ) {}
+    //NB: future which has failed already won't fire again, so we don't wait for it
+    bool await_ready() const {
+        return future.infraGetPtr()->isDataReady() || future.infraGetPtr()->isFailed();
+    }
+    void await_suspend( coro::coroutine_handle<> h ) {
+        future.then( CoResume( h, &ex ) );
+    }
+    auto await_resume() const -> decltype( future.value() ) {
+        if( ex )
+            infraRethrow( *ex );
+        if( !future.infraGetPtr()->isDataReady() )
+            infraRethrow( future.infraGetPtr()->infraGetError() );
+        return future.value();
+    }
+};
+
+//co_await MultiFuture<T>: waits for the next item
+//  NB: onEach() replaces the continuation from within itself, if the coroutine co_await's the same MultiFuture again;
+//      CoResume is trivially destructible, and doesn't touch itself after resume(), so it is fine
+template< typename T >
+class MultiFutureAwaiter {
+    MultiFuture< T > future;
+    const std::exception* ex = nullptr;
+
+  public:
+    explicit MultiFutureAwaiter( const MultiFuture< T >& f ) : future( f ) {}
+    bool await_ready() const {
+        return false;
+    }
+    void await_suspend( coro::coroutine_handle<> h ) {
+        future.onEach( CoResume( h, &ex ) );
+    }
+    const T& await_resume() const {
+        if( ex )
+            infraRethrow( *ex );
+        return future.value();
+    }
+};
+
+template< typename T >
+FutureAwaiter< Future< T > > operator co_await( const Future< T >& f ) {
+    return FutureAwaiter< Future< T > >( f );
+}
+
+template< typename T >
+FutureAwaiter< SharedFuture< T > > operator co_await( const SharedFuture< T >& f ) {
+    return FutureAwaiter< SharedFuture< T > >( f );
+}
+
+template< typename T >
+MultiFutureAwaiter< T > operator co_await( const MultiFuture< T >& f ) {
+    return MultiFutureAwaiter< T >( f );
+}
+
+}
+
+template< typename N, typename... Args >
+struct ACORO_NAMESPACE::coroutine_traits< autom::CoTask, N*, Args... > {
+    using promise_type = typename std::conditional < autom::CoTaskIsNode< N >::value, autom::CoTaskNodePromise< N*, Args... >,
+          autom::CoTask::promise_type >::type;
+};
+
+template< typename N, typename... Args >
+struct ACORO_NAMESPACE::coroutine_traits< autom::CoTask, N&, Args... > {
+    using promise_type = typename std::conditional < autom::CoTaskIsNode< N >::value, autom::CoTaskNodePromise< N&, Args... >,
+          autom::CoTask::promise_type >::type;
+};
+
+#endif //ACORO_ENABLED
+
+#endif
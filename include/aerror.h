@@ -0,0 +1,62 @@
+/*******************************************************************************
+Copyright (C) 2016 OLogN Technologies AG
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*******************************************************************************/
+
+#ifndef AERROR_H
+#define AERROR_H
+
+#include <exception>
+#include <typeinfo>
+
+namespace autom {
+
+//Error status which goes to continuations (as their const std::exception*) and to CCATCH handlers as it is:
+//  nothing is thrown, caught or allocated to deliver it, so closes, resets and timeouts cost about the same as data
+//  infrastructure uses the instances from get(); user code MAY have its own static ones, with codes from USER up
+//  NB: it is still a std::exception, so handlers which don't care about codes just see what()
+class ErrorStatus final : public std::exception {
+    int errCode;
+    const char* message;
+
+  public:
+    enum { CLOSED = 1, RESET, CONNECT_FAILED, TIMEOUT, USER = 256 };
+
+    ErrorStatus( int code_, const char* message_ ) : errCode( code_ ), message( message_ ) {}
+
+    int code() const {
+        return errCode;
+    }
+    const char* what() const noexcept override {
+        return message;
+    }
+
+    static const ErrorStatus& get( int code ) {
+        static const ErrorStatus all[] = {
+            ErrorStatus( 0, "unknown error" ),
+            ErrorStatus( CLOSED, "connection closed" ),
+            ErrorStatus( RESET, "connection reset" ),
+            ErrorStatus( CONNECT_FAILED, "connect failed" ),
+            ErrorStatus( TIMEOUT, "deadline is over" ),
+        };
+        return code > 0 && code <= TIMEOUT ? all[code] : all[0];
+    }
+};
+
+//Code of x if it is an ErrorStatus, 0 otherwise (such as for an exception thrown by a step)
+inline int errorCode( const std::exception& x ) {
+    return typeid( x ) == typeid( ErrorStatus ) ? static_cast< const ErrorStatus& >( x ).code() : 0;
+}
+
+}
+
+#endif
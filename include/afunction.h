@@ -0,0 +1,262 @@
+/*******************************************************************************
+Copyright (C) 2016 OLogN Technologies AG
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*******************************************************************************/
+
+#ifndef AFUNCTION_H
+#define AFUNCTION_H
+
+#include <cstddef>
+#include <new>
+#include <stdexcept>
+#include <typeinfo>
+#include <type_traits>
+#include <utility>
+
+#include "aassert.h"
+
+#ifndef AFUNCTION_INLINE_SIZE
+#define AFUNCTION_INLINE_SIZE 48 // Default inline capacity (in bytes) for InlineFunction<>
+#endif
+
+//NB: MSVC doesn't support single-parameter static_assert() :-(
+static_assert( AFUNCTION_INLINE_SIZE >= sizeof( void* ), "AFUNCTION_INLINE_SIZE >= sizeof( void* )" );
+
+//Callables which don't fit into InlineFunction's buffer fall back to the heap
+//#define AFUNCTION_HEAP_WARNINGS
+//  if defined, with a compile-time warning for each such callable type (to find the ones worth trimming)
+//#define AFUNCTION_INLINE_ONLY
+//  if defined, such a callable is a compile-time error instead
+#if defined( AFUNCTION_INLINE_ONLY ) || !defined( AFUNCTION_HEAP_WARNINGS )
+#define AFUNCTION_HEAP_WARNING
+#elif defined( _MSC_VER )
+#define AFUNCTION_HEAP_WARNING __declspec( deprecated( "Callable doesn't fit into InlineFunction and goes to the heap; reduce lambda captures or increase AFUNCTION_INLINE_SIZE" ) )
+#else
+#define AFUNCTION_HEAP_WARNING __attribute__(( deprecated( "Callable doesn't fit into InlineFunction and goes to the heap; reduce lambda captures or increase AFUNCTION_INLINE_SIZE" ) ))
+#endif
+
+namespace autom {
+
+template< typename Sig, size_t Capacity = AFUNCTION_INLINE_SIZE >
+class InlineFunction;
+
+//Move-only replacement for std::function<>
+//  callables of up to Capacity bytes are stored in-place, without any heap allocations
+template< typename R, typename... Args, size_t Capacity >
+class InlineFunction< R( Args... ), Capacity > {
+    using Storage = typename std::aligned_storage< Capacity, alignof( std::max_align_t ) >::type;
+
+    struct Ops {
+        R( *invoke )( void* obj, Args... args );
+        void ( *move )( void* dst, void* src );//move-constructs dst, destroys src
+        void ( *destroy )( void* obj );
+        void ( *clone )( void* dst, const void* src );//throws for non-copyable callables, leaving dst as it is
+        void* ( *get )( void* obj );
+        const std::type_info& ( *type )();
+    };
+
+    template< typename F >
+    struct FitsInline {
+        static const bool value = sizeof( F ) <= Capacity && alignof( F ) <= alignof( std::max_align_t );
+    };
+
+    //F stored in-place
+    template< typename F >
+    struct InlineHolder {
+        static F* ptr( void* obj ) {
+            return static_cast<F*>( obj );
+        }
+        static R invoke( void* obj, Args... args ) {
+            return ( *ptr( obj ) )( std::forward< Args >( args )... );
+        }
+        static void move( void* dst, void* src ) {
+            new( dst ) F( std::move( *ptr( src ) ) );
+            ptr( src )->~F();
+        }
+        static void destroy( void* obj ) {
+            ptr( obj )->~F();
+        }
+        static void clone( void* dst, const void* src ) {
+            cloneImpl( dst, src, std::is_copy_constructible< F >() );
+        }
+        static void cloneImpl( void* dst, const void* src, std::true_type ) {
+            new( dst ) F( *static_cast<const F*>( src ) );
+        }
+        static void cloneImpl( void*, const void*, std::false_type ) {
+            throw std::logic_error( "InlineFunction::clone() on non-copyable callable" );
+        }
+        static void* get( void* obj ) {
+            return obj;
+        }
+    };
+
+    //F stored on the heap, only F* in-place
+    template< typename F >
+    struct HeapHolder {
+        static F*& ptr( void* obj ) {
+            return *static_cast<F**>( obj );
+        }
+        static R invoke( void* obj, Args... args ) {
+            return ( *ptr( obj ) )( std::forward< Args >( args )... );
+        }
+        static void move( void* dst, void* src ) {
+            new( dst ) F*( ptr( src ) );
+        }
+        static void destroy( void* obj ) {
+            delete ptr( obj );
+        }
+        static void clone( void* dst, const void* src ) {
+            cloneImpl( dst, src, std::is_copy_constructible< F >() );
+        }
+        static void cloneImpl( void* dst, const void* src, std::true_type ) {
+            new( dst ) F*( new F( **static_cast<F* const*>( src ) ) );
+        }
+        static void cloneImpl( void*, const void*, std::false_type ) {
+            throw std::logic_error( "InlineFunction::clone() on non-copyable callable" );
+        }
+        static void* get( void* obj ) {
+            return ptr( obj );
+        }
+    };
+
+    //NB: warns (see AFUNCTION_HEAP_WARNING) where InlineFunction is constructed from F
+    template< typename F >
+    struct HeapFallback {
+        AFUNCTION_HEAP_WARNING static void warn() {}
+    };
+
+    template< typename F >
+    static const std::type_info& typeOf() {
+        return typeid( F );
+    }
+
+    template< typename Holder, typename F >
+    static const Ops* opsFor() {
+        static const Ops ops = { &Holder::invoke, &Holder::move, &Holder::destroy, &Holder::clone, &Holder::get, &typeOf< F > };
+        return &ops;
+    }
+
+    template< typename F >
+    void construct( F&& f, std::true_type ) {
+        using D = typename std::decay< F >::type;
+        new( &storage ) D( std::forward< F >( f ) );
+        ops = opsFor< InlineHolder< D >, D >();
+    }
+    template< typename F >
+    void construct( F&& f, std::false_type ) {
+        using D = typename std::decay< F >::type;
+#ifdef AFUNCTION_INLINE_ONLY
+        static_assert( FitsInline< D >::value, "Callable doesn't fit into InlineFunction; reduce lambda captures or increase AFUNCTION_INLINE_SIZE" );
+#endif
+        HeapFallback< D >::warn();
+        new( &storage ) D*( new D( std::forward< F >( f ) ) );
+        ops = opsFor< HeapHolder< D >, D >();
+    }
+
+    void reset() {
+        if( ops ) {
+            //NB: clearing ops first, as destroying callable MAY get back to us
+            auto o = ops;
+            ops = nullptr;
+            o->destroy( &storage );
+        }
+    }
+
+    template< typename F >
+    using EnableIfCallable = typename std::enable_if <
+                             !std::is_same< typename std::decay< F >::type, InlineFunction >::value &&
+                             std::is_convertible< decltype( std::declval< typename std::decay< F >::type& >()( std::declval< Args >()... ) ), R >::value >::type;
+
+    mutable Storage storage;
+    const Ops* ops = nullptr;
+
+  public:
+    static const size_t capacity = Capacity;
+
+    InlineFunction() {}
+    InlineFunction( std::nullptr_t ) {}
+    template< typename F, typename = EnableIfCallable< F > >
+    InlineFunction( F&& f ) {
+        using D = typename std::decay< F >::type;
+        construct( std::forward< F >( f ), std::integral_constant< bool, FitsInline< D >::value >() );
+    }
+    InlineFunction( InlineFunction&& other ) {
+        if( other.ops ) {
+            other.ops->move( &storage, &other.storage );
+            ops = other.ops;
+            other.ops = nullptr;
+        }
+    }
+    InlineFunction( const InlineFunction& ) = delete;
+    ~InlineFunction() {
+        reset();
+    }
+
+    InlineFunction& operator=( InlineFunction&& other ) {
+        if( this != &other ) {
+            reset();
+            if( other.ops ) {
+                other.ops->move( &storage, &other.storage );
+                ops = other.ops;
+                other.ops = nullptr;
+            }
+        }
+        return *this;
+    }
+    InlineFunction& operator=( const InlineFunction& ) = delete;
+    InlineFunction& operator=( std::nullptr_t ) {
+        reset();
+        return *this;
+    }
+    template< typename F, typename = EnableIfCallable< F > >
+    InlineFunction& operator=( F&& f ) {
+        //NB: constructing first, as f MAY be owned by our current callable
+        InlineFunction tmp( std::forward< F >( f ) );
+        return *this = std::move( tmp );
+    }
+
+    explicit operator bool() const {
+        return ops != nullptr;
+    }
+
+    R operator()( Args... args ) const {
+        AASSERT4( ops, "Calling empty InlineFunction" );
+        return ops->invoke( &storage, std::forward< Args >( args )... );
+    }
+
+    //Explicit copy; throws std::logic_error if the stored callable is not copyable
+    //  NB: the callable type is known only at run time here, so callers which clone (such as CTryStep::ccatch())
+    //      SHOULD check copyability at compile time, where the type is still known
+    InlineFunction clone() const {
+        InlineFunction ret;
+        if( ops ) {
+            ops->clone( &ret.storage, &storage );//NB: ret.ops only once the callable is there
+            ret.ops = ops;
+        }
+        return ret;
+    }
+
+    bool isInline() const {
+        return ops && ops->get( &storage ) == &storage;
+    }
+
+    template< typename T >
+    T* target() const {
+        if( !ops || ops->type() != typeid( T ) )
+            return nullptr;
+        return static_cast<T*>( ops->get( &storage ) );
+    }
+};
+
+}
+
+#endif
@@ -16,17 +16,23 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #define ANODE_H
 
 #include <exception>
-#include <unordered_map>
+#include <new>
+#include <vector>
 
 #include "aassert.h"
+#include "afunction.h"
 #include "abuffer.h"
+#include "zeronet.h"
 #include "../libsrc/infra/infraconsole.h"
 #include "../libsrc/infra/loopcontainer.h"
+#include "../libsrc/infra/futurepool.h"
+#include "../libsrc/infra/futureslotmap.h"
+#include "../libsrc/infra/nodequeue.h"
 
 namespace autom {
 
-using FutureFunction = std::function< void( const std::exception* ) >;
-using FutureId = unsigned int;
+//NB: FutureFunction is large enough to hold a whole StepFunction in-place (see CStep)
+using FutureFunction = InlineFunction< void( const std::exception* ), sizeof( InlineFunction< void( void ) > ) >;
 
 class Node;
 class InfraFutureBase;
@@ -41,44 +47,135 @@ struct NodeQTimer : public NodeQItem {
 };
 
 struct NodeQAccept : public NodeQItem {
-    TcpSocket* sock;
+    TcpZeroSocket zero;
 };
 
 struct NodeQBuffer : public NodeQItem {
     NetworkBuffer b;
-    FutureId closeId;
+    FutureId closeId = 0;
 };
 
 struct NodeQConnect : public NodeQItem {
-    TcpSocket* sock;
+    TcpZeroSocket zero;
 };
 
 struct NodeQClosed : public NodeQItem {
+    int code = 0;//ErrorStatus code
 };
 
-class Node {
-    using FutureMap = std::unordered_map< FutureId, std::unique_ptr< InfraFutureBase > >;
-    FutureMap futureMap;
-    FutureId nextFutureIdCount = 0;
+enum class NODEQ { NONE, TIMER, ACCEPT, READ, READ_BUFFERED, CLOSED, CONNECT };
 
+//Any of NodeQ* items, tagged; this is what Node queues (see Node::infraPost())
+class NodeQEvent {
   public:
-    virtual ~Node() = default;
-    LoopContainer* parentLoop;
-
-    FutureId nextFutureId() {
-        return ++nextFutureIdCount;
+    NODEQ type;
+    union {
+        NodeQItem item;
+        NodeQTimer timer;
+        NodeQAccept accept;
+        NodeQBuffer buffer;//READ and READ_BUFFERED
+        NodeQConnect connect;
+        NodeQClosed closed;
+    };
+
+  private:
+    bool hasBuffer() const {
+        return NODEQ::READ == type || NODEQ::READ_BUFFERED == type;
+    }
+    void construct( NodeQEvent&& other ) {
+        type = other.type;
+        if( hasBuffer() )
+            new( &buffer ) NodeQBuffer( std::move( other.buffer ) );
+        else if( NODEQ::ACCEPT == type )
+            new( &accept ) NodeQAccept( other.accept );
+        else if( NODEQ::CONNECT == type )
+            new( &connect ) NodeQConnect( other.connect );
+        else if( NODEQ::CLOSED == type )
+            new( &closed ) NodeQClosed( other.closed );
+        else
+            new( &item ) NodeQItem( other.item );
+    }
+    void destroy() {
+        if( hasBuffer() )
+            buffer.~NodeQBuffer();
     }
 
-    InfraFutureBase* insertInfraFuture( FutureId id, InfraFutureBase* inf );
-    InfraFutureBase* findInfraFuture( FutureId id );
-    void futureCleanup();
+  public:
+    NodeQEvent() : type( NODEQ::NONE ), item() {}
+    explicit NodeQEvent( const NodeQTimer& t ) : type( NODEQ::TIMER ), timer( t ) {}
+    explicit NodeQEvent( const NodeQAccept& a ) : type( NODEQ::ACCEPT ), accept( a ) {}
+    NodeQEvent( NODEQ type_, NodeQBuffer&& b ) : type( type_ ), buffer( std::move( b ) ) {
+        AASSERT4( hasBuffer() );
+    }
+    explicit NodeQEvent( const NodeQConnect& c ) : type( NODEQ::CONNECT ), connect( c ) {}
+    explicit NodeQEvent( const NodeQClosed& c ) : type( NODEQ::CLOSED ), closed( c ) {}
+    NodeQEvent( NodeQEvent&& other ) {
+        construct( std::move( other ) );
+    }
+    NodeQEvent& operator=( NodeQEvent&& other ) {
+        if( this != &other ) {
+            destroy();
+            construct( std::move( other ) );
+        }
+        return *this;
+    }
+    NodeQEvent( const NodeQEvent& ) = delete;
+    NodeQEvent& operator=( const NodeQEvent& ) = delete;
+    ~NodeQEvent() {
+        destroy();
+    }
+};
 
+//NB: events from the zero layer are not processed right away, but queued with infraPost();
+//    all the events queued by the time the loop gets to the Node are processed in one batch,
+//    followed by a single futureCleanup()
+class Node : private InfraLoopTask {
+    //NB: declaration order matters for destruction: destroying futureMap returns InfraFutures to futurePool,
+    //    and MAY release more InfraFutures into releasedFutures
+    std::vector< InfraFutureBase* > releasedFutures;
+    //InfraFutures whose refCount has dropped to zero since the last futureCleanup()
+    InfraFuturePool futurePool;
+    InfraFuturePool framePool;//coroutine frames of CoTask's (see acoro.h)
+    InfraFutureSlotMap futureMap{ futurePool };
+    InfraQueue< NodeQEvent > eventQueue;
+    bool eventsScheduled = false;
+
+    void infraRunLoopTask() override;
     void infraProcessTimer( const NodeQTimer& item );
     void infraProcessTcpAccept( const NodeQAccept& item );
     void infraProcessTcpRead( const NodeQBuffer& item );
+    void infraProcessTcpReadBuffered( const NodeQBuffer& item );
     void infraProcessTcpClosed( const NodeQClosed& item );
     void infraProcessTcpConnect( const NodeQConnect& item );
 
+  public:
+    virtual ~Node();
+    LoopContainer* parentLoop = nullptr;
+
+    FutureId insertInfraFuture( InfraFutureBase* inf );
+    InfraFuturePool& infraFuturePool() {
+        return futurePool;
+    }
+    const InfraFuturePool::Stats& futurePoolStats() const {
+        return futurePool.getStats();
+    }
+    InfraFuturePool& infraFramePool() {
+        return framePool;
+    }
+    const InfraFuturePool::Stats& framePoolStats() const {
+        return framePool.getStats();
+    }
+    void infraQueueRelease( InfraFutureBase* inf ) {
+        releasedFutures.push_back( inf );
+    }
+    InfraFutureBase* findInfraFuture( FutureId id ) const {
+        return futureMap.find( id );
+    }
+    void futureCleanup();
+
+    void infraPost( NodeQEvent&& ev );
+    void infraProcessEvents();
+
     virtual void run() = 0;
 
     bool isEmpty() const;
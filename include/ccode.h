@@ -15,60 +15,188 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #ifndef CCODE_H
 #define CCODE_H
 
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+
 #include "aassert.h"
+#include "aerror.h"
+#include "cprofile.h"
 #include "future.h"
 #include "../libsrc/infra/infraconsole.h"
 #include "timer.h"
 
 namespace autom {
 
-using StepFunction = std::function< void( void ) >;
-using ExHandlerFunction = std::function< void( const std::exception& ) >;
+using StepFunction = InlineFunction< void( void ) >;
+using ExHandlerFunction = InlineFunction< void( const std::exception& ) >;
+
+//Runs StepFunction as FutureFunction; fits into FutureFunction in-place (see FutureFunction)
+struct StepAdapter {
+    StepFunction fn;
+
+    explicit StepAdapter( StepFunction&& fn_ ) : fn( std::move( fn_ ) ) {}
+    void operator()( const std::exception* ) const {
+        fn();
+    }
+};
+static_assert( sizeof( StepAdapter ) <= FutureFunction::capacity, "StepAdapter MUST fit into FutureFunction in-place" );
+
+class AStep;
+
+//Cancels CCode programs started with it (see CCODE_WITH): their WAIT steps waiting now are torn down right away
+//  (releasing their futures), and their steps which are not waiting yet are dropped before execution; handlers are not called
+//  cost is O(steps waiting), as they are the only ones we keep track of
+//  NB: token MUST outlive running programs; destroying the token cancels them
+class CancelToken {
+    friend class CCode;
+
+    AStep* waiting = nullptr;//WAIT steps waiting now, doubly-linked via AStep::waiting
+    bool cancelled = false;
+
+  public:
+    CancelToken() {}
+    CancelToken( const CancelToken& ) = delete;
+    CancelToken& operator=( const CancelToken& ) = delete;
+    ~CancelToken() {
+        cancel();
+    }
+
+    void cancel();
+    bool isCancelled() const {
+        return cancelled;
+    }
+};
+
+//Bump-pointer arena owning the steps of one CCode program (see AStep::operator new)
+//  steps are built before their CCode exists, so they go to the arena being built on this thread; CCode constructor seals it
+//  (steps built after that go to a new one), and the arena is released once the last of its steps is deleted,
+//  be it because the program is over, or because its chain has been discarded by an exception or a CancelToken
+//  released arenas are kept per thread for the programs to come, so that in a steady state no step touches the global heap
+//  NB: with ACCODE_HEAP_STEPS defined, steps go to the global heap one by one, as before (such as for address sanitizers)
+class AStepArena {
+  public:
+    //Counters of the calling thread (since it has started)
+    struct Stats {
+        uint64_t programs = 0;//arenas sealed
+        uint64_t steps = 0;
+        uint64_t heapAllocs = 0;//arenas and chunks taken from the global heap
+        uint64_t heapBytes = 0;
+        uint64_t reused = 0;//arenas taken from the ones released before
+    };
 
+    static void* alloc( size_t sz );
+    static void release( void* p );
+    static void seal();
+    static const Stats& stats();
+};
 
 class AStep {
     friend class CStep;
     friend class CIfStep;
     friend class CTryStep;
+    friend class CParStep;
     friend class CCode;
-    friend struct IifFunctor;
-    friend struct EelseFunctor;
     friend struct WaitFunctor;
-    friend struct WhileFunctor;
+    friend struct DeadlineFunctor;
+    friend class CancelToken;
+    friend class CStepAt;
 
     bool stepReady;
-    enum { NONE = ' ', WAIT = 'W', EXEC = 'E', COND = 'C', LOOP = 'L' };
+    enum { NONE = ' ', WAIT = 'W', EXEC = 'E', COND = 'C', LOOP = 'L', PAR = 'P' };
+    enum { PAR_OK, PAR_CAUGHT, PAR_FAILED };//how PAR branch has ended: normally, with an exception caught by TTRY around PAR, with an exception not caught at all
     char debugOpCode;
-    InfraFutureBase* infraPtr;
-    FutureFunction fn;
+    InfraFutureBase* infraPtr;//WAIT
+    FutureFunction fn;//EXEC
     ExHandlerFunction exHandler;
-    int exId;
-    int refCount;
-    AStep* next;
-    AStep* nextExec;
+    int exId;//TTRY the handler comes from
+    int exDepth;//number of TTRY's around the step (so that a TTRY nested in another one is told from the one after it)
+    AStep* next;//nullptr at the end of a chain
+    AStep* up;//end of a branch/loop body: its COND/LOOP/PAR step, where runChain() continues from
+    bool owned;//within a loop body or PAR branch: owned by the LOOP/PAR step, never deleted after execution (see CCode::runChain())
+    CancelToken* token;//of the program, if any
+
+    //WAIT which has been reached before its future is ready (see CCode::startWaiting())
+    struct Waiting {
+        unsigned deadlineMs = 0;//AWAIT_FOR
+        InfraFutureBase* deadline = nullptr;//timer, while armed; we hold a reference
+        ZeroTimeout timer;//of deadline; released in CCode::stopWaiting()
+        bool listed = false;//in token's list
+        AStep* prev = nullptr;
+        AStep* next = nullptr;
+#ifdef ACCODE_PROFILING
+        uint64_t since = 0;//while waiting
+#endif
+    } waiting;
+#ifdef ACCODE_PROFILING
+    StepSite* site;//where the step comes from, if it has been built with CCODE macros
+#endif
+
+    //Control-flow metadata, valid for COND, LOOP and PAR only
+    //  COND: IIF( b ) c1..e1 EELSE c2..e2 (c2 is nullptr without EELSE)
+    //  LOOP: WWHILE( b ) c1..e1
+    //  PAR: PPARALLEL c1..e1 AAND c2..e2 (more AAND's are nested PAR's in the second branch)
+    //  we hold a reference to b, see ~AStep()
+    struct Branches {
+        InfraFuture< bool >* b = nullptr;
+        AStep* c1 = nullptr;
+        AStep* e1 = nullptr;
+        AStep* c2 = nullptr;
+        AStep* e2 = nullptr;
+        int pending = 0;//PAR: branches still running
+        char failure = PAR_OK;//PAR: worst of the branches which have ended
+    } branches;
 
   public:
     AStep() {
         debugOpCode = NONE;
         infraPtr = nullptr;
-        nextExec = next = nullptr;
+        exId = 0;
+        exDepth = 0;
+        up = next = nullptr;
         stepReady = false;
-        refCount = 1;
+        owned = false;
+        token = nullptr;
+#ifdef ACCODE_PROFILING
+        site = nullptr;
+#endif
     }
-    explicit AStep( FutureFunction fn_ ) {
+    explicit AStep( FutureFunction fn_ ) : AStep() {
         AASSERT4( fn_ );
         debugOpCode = EXEC;
-        infraPtr = nullptr;
-        nextExec = next = nullptr;
-        fn = fn_;
-        stepReady = false;
-        refCount = 1;
+        fn = std::move( fn_ );
+    }
+    AStep( char opCode, AStep* c1 ) : AStep() {
+        AASSERT4( opCode == COND || opCode == LOOP || opCode == PAR );
+        AASSERT4( c1 );
+        debugOpCode = opCode;
+        branches.c1 = c1;
+        branches.e1 = c1->endOfChain();
+        branches.e1->up = this;
+    }
+    AStep( char opCode, const Future<bool>& b, AStep* c1 ) : AStep( opCode, c1 ) {
+        AASSERT4( opCode == COND || opCode == LOOP );
+        branches.b = static_cast< InfraFuture< bool >* >( b.infraGetPtr() );
+        branches.b->refCount++;
     }
     AStep( AStep&& other );
-    AStep( const AStep& other ) = default;
-    ~AStep() = default;
+    AStep( const AStep& other ) = delete;
+    ~AStep() {
+        if( branches.b )
+            branches.b->releaseRef();
+    }
+
+    static void* operator new( size_t sz ) {
+        return AStepArena::alloc( sz );
+    }
+    static void operator delete( void* p ) {
+        AStepArena::release( p );
+    }
 
   private:
+    bool hasBranches() const {
+        return COND == debugOpCode || LOOP == debugOpCode || PAR == debugOpCode;
+    }
     AStep* endOfChain() {
         auto p = this;
         while( p->next )
@@ -94,16 +222,16 @@ class AStep {
 class CStep {
     friend class CIfStep;
     friend class CTryStep;
+    friend class CParStep;
     friend class CCode;
+    friend class CStepAt;
 
     AStep* step;
 
   public:
     explicit CStep( AStep* p ) : step( p ) {}
     explicit CStep( StepFunction fn ) {
-        step = new AStep( [ = ]( const std::exception* ) {
-            fn();
-        } );
+        step = new AStep( StepAdapter( std::move( fn ) ) );
     }
     CStep( const CStep& ) = default;
     CStep( CStep&& ) = default;
@@ -111,20 +239,20 @@ class CStep {
 
   private:
     static CStep chain( StepFunction fn ) {
-        return CStep( fn );
+        return CStep( std::move( fn ) );
     }
     static CStep chain( CStep s ) {
         return s;
     }
     template< typename... Ts >
     static CStep chain( StepFunction fn, Ts&&... Vals ) {
-        CStep s( fn );
-        s.step->next = chain( Vals... ).step;
+        CStep s( std::move( fn ) );
+        s.step->next = chain( std::forward< Ts >( Vals )... ).step;
         return s;
     }
     template< typename... Ts >
     static CStep chain( CStep s, Ts&&... Vals ) {
-        s.step->endOfChain()->next = chain( Vals... ).step;
+        s.step->endOfChain()->next = chain( std::forward< Ts >( Vals )... ).step;
         return s;
     }
 };
@@ -132,7 +260,7 @@ class CStep {
 class CIfStep : public CStep {
   public:
     explicit CIfStep( AStep* p ) : CStep( p ) {}
-    explicit CIfStep( StepFunction fn ) : CStep( fn ) {}
+    explicit CIfStep( StepFunction fn ) : CStep( std::move( fn ) ) {}
     CIfStep( const CIfStep& ) = default;
     CIfStep( CIfStep&& ) = default;
     CIfStep& operator=( CIfStep&& ) = default;
@@ -142,7 +270,7 @@ class CIfStep : public CStep {
 
   public:
     CStep eelse( StepFunction fn ) {
-        CStep s( fn );
+        CStep s( std::move( fn ) );
         infraEelseImpl( s.step );
         return *this;
     }
@@ -153,7 +281,7 @@ class CIfStep : public CStep {
     }
     template< typename... Ts >
     CStep eelse( StepFunction fn, Ts... Vals ) {
-        CStep s( fn );
+        CStep s( std::move( fn ) );
         s.step->next = chain( Vals... ).step;
         infraEelseImpl( s.step );
         return *this;
@@ -171,76 +299,217 @@ class CTryStep : public CStep {
   public:
     explicit CTryStep( AStep* p ) : CStep( p ) {}
     explicit CTryStep( CStep s ) : CStep( s ) {}
-    explicit CTryStep( StepFunction fn ) : CStep( fn ) {}
+    explicit CTryStep( StepFunction fn ) : CStep( std::move( fn ) ) {}
     CTryStep( const CTryStep& ) = default;
     CTryStep( CTryStep&& ) = default;
     CTryStep& operator=( CTryStep&& ) = default;
 
-    CTryStep ccatch( ExHandlerFunction handler );
+  private:
+    CTryStep infraCcatchImpl( ExHandlerFunction handler );
+
+  public:
+    //NB: each step of the TTRY block gets its own copy of the handler (see CCode::setExhandlerChain())
+    template< typename F >
+    CTryStep ccatch( F&& handler ) {
+        static_assert( std::is_copy_constructible< typename std::decay< F >::type >::value, "CCATCH handler MUST be copyable" );
+        return infraCcatchImpl( ExHandlerFunction( std::forward< F >( handler ) ) );
+    }
+};
+
+class CParStep : public CStep {
+  public:
+    explicit CParStep( AStep* p ) : CStep( p ) {}
+    CParStep( const CParStep& ) = default;
+    CParStep( CParStep&& ) = default;
+    CParStep& operator=( CParStep&& ) = default;
+
+  private:
+    void infraAandImpl( AStep* branch );
+
+  public:
+    CParStep aand( StepFunction fn ) {
+        CStep s( std::move( fn ) );
+        infraAandImpl( s.step );
+        return *this;
+    }
+    CParStep aand( CStep s ) {
+        infraAandImpl( s.step );
+        return *this;
+    }
+    template< typename... Ts >
+    CParStep aand( StepFunction fn, Ts&&... Vals ) {
+        CStep s( std::move( fn ) );
+        s.step->next = chain( std::forward< Ts >( Vals )... ).step;
+        infraAandImpl( s.step );
+        return *this;
+    }
+    template< typename... Ts >
+    CParStep aand( CStep s, Ts&&... Vals ) {
+        s.step->next = chain( std::forward< Ts >( Vals )... ).step;
+        infraAandImpl( s.step );
+        return *this;
+    }
+};
+
+#ifdef ACCODE_PROFILING
+//Result of ACCODE_AT: tags the step which comes after it with its StepSite
+//  for AWAIT, IIF, WWHILE and PPARALLEL, it is the WAIT/COND/LOOP/PAR step; otherwise, the step lambda
+class CStepAt {
+    StepSite* site;
+
+    void tag( AStep* s ) const {
+        s->site = site;
+        site->op = s->debugOpCode;
+    }
+
+  public:
+    explicit CStepAt( StepSite* site_ ) : site( site_ ) {}
+
+    template< typename S >
+    typename std::enable_if< std::is_base_of< CStep, typename std::decay< S >::type >::value, typename std::decay< S >::type >::type operator*( S&& s ) const {
+        typename std::decay< S >::type r( std::forward< S >( s ) );
+        tag( r.step );
+        return r;
+    }
+    template< typename F >
+    typename std::enable_if < !std::is_base_of< CStep, typename std::decay< F >::type >::value, CStep >::type operator*( F&& f ) const {
+        CStep r{ StepFunction( std::forward< F >( f ) ) };
+        tag( r.step );
+        return r;
+    }
 };
+#endif
 
 class CCode {
+    friend struct WaitFunctor;
+    friend struct DeadlineFunctor;
+    friend class CancelToken;
+
   public:
     CCode( const CStep& s ) {
         s.step->debugDumpChain( "main\n" );
+        infraProfileChain( s.step );
+        AStepArena::seal();
         exec( s.step );
     }
     CCode( StepFunction fn ) {
-        CStep s( fn );
+        CStep s( std::move( fn ) );
         s.step->debugDumpChain( "main\n" );
+        infraProfileChain( s.step );
+        AStepArena::seal();
         exec( s.step );
     }
     template< typename... Ts >
     CCode( const CStep& s, Ts... Vals ) {
         s.step->next = CStep::chain( Vals... ).step;
         s.step->debugDumpChain( "main\n" );
+        infraProfileChain( s.step );
+        AStepArena::seal();
         exec( s.step );
     }
     template< typename... Ts >
     CCode( StepFunction fn, Ts... Vals ) {
-        CStep s( fn );
+        CStep s( std::move( fn ) );
         s.step->next = CStep::chain( Vals... ).step;
         s.step->debugDumpChain( "main\n" );
+        infraProfileChain( s.step );
+        AStepArena::seal();
         exec( s.step );
     }
+    //Program which MAY be cancelled with token (see CancelToken)
+    template< typename... Ts >
+    CCode( CancelToken& token, const CStep& first, Ts... Vals ) {
+        CStep s = CStep::chain( first, Vals... );
+        s.step->debugDumpChain( "main\n" );
+        infraProfileChain( s.step );
+        setTokenChain( s.step, &token );
+        AStepArena::seal();
+        exec( s.step );
+    }
+    template< typename... Ts >
+    CCode( CancelToken& token, StepFunction fn, Ts... Vals ) : CCode( token, CStep( std::move( fn ) ), Vals... ) {}
 
     static void exec( AStep* s );
+    //Fails the step being executed once it returns, same as if it has thrown x, but without throwing
+    //  NB: the rest of the step still runs, so return right after it; x is copied, so it MAY be a temporary
+    //      (but its message is not, so it MUST be a string literal or the like, see ErrorStatus)
+    static void fail( ErrorStatus x );
     static void deleteChain( AStep* s, const AStep* e );
-    static AStep* deleteExChain( AStep* s );
-    static void setExhandlerChain( AStep* s, ExHandlerFunction handler );
-    static void addRefChain( AStep* s, const AStep* e );
+    static AStep* unwind( AStep* s, bool toHandler );
+    static void setExhandlerChain( AStep* s, const ExHandlerFunction& handler );
+    static void setOwnedChain( AStep* s );
+    static void setTokenChain( AStep* s, CancelToken* token );
+#ifdef ACCODE_PROFILING
+    static void infraProfileChain( AStep* s );
+    static CStepAt infraAt( StepSite* site ) {
+        return CStepAt( site );
+    }
+#else
+    static void infraProfileChain( AStep* ) {}
+#endif
+
+  private:
+    static void runChain( AStep* s );
+    static AStep* failStep( AStep* s, const std::exception& x );
+    static void resume( AStep* s );
+    static void startWaiting( AStep* s );
+    static void stopWaiting( AStep* s );
+    static void expire( AStep* s );
+    static AStep* successor( AStep* s );
+    static AStep* joinBranch( AStep* head, char how );
+    static AStep* execCond( AStep* head );
+    static AStep* exitLoop( AStep* head );
+    static void releaseStep( AStep* s );
+    static void dropStep( AStep* s );
+    template< typename Visit >
+    static void walkChain( AStep* s, const AStep* e, Visit&& visit );
+
+  public:
 
     static CTryStep ttry( CStep s ) {
         s.step->debugDump( "ttry 1" );
         return CTryStep( s );
     }
     static CTryStep ttry( StepFunction fn ) {
-        CTryStep s( fn );
+        CTryStep s( std::move( fn ) );
         s.step->debugDump( "ttry 2" );
         return s;
     }
     template< typename... Ts >
     static CTryStep ttry( CStep s, Ts&&... Vals ) {
-        s.step->next = ttry( Vals... ).step;
+        s.step->next = ttry( std::forward< Ts >( Vals )... ).step;
         s.step->debugDump( "ttry 3" );
         return CTryStep( s );
     }
     template< typename... Ts >
     static CTryStep ttry( StepFunction fn, Ts&&... Vals ) {
-        CTryStep s = ttry( fn );
-        s.step->next = ttry( Vals... ).step;
+        CTryStep s = ttry( std::move( fn ) );
+        s.step->next = ttry( std::forward< Ts >( Vals )... ).step;
         s.step->debugDump( "ttry 4" );
         return s;
     }
     static CStep waitFor( const FutureBase& future );
+    //Same as waitFor( future ), but the step fails with ErrorStatus::TIMEOUT if future is not ready within msTimeout since it has been reached
+    static CStep waitFor( const FutureBase& future, unsigned msTimeout );
+    //Single WAIT for all of the futures (or for the first of them, see whenAll()/whenAny())
+    //  NB: to know which future of waitAny() has been the first, AWAIT( whenAny(...) ) explicitly, and check its value()
+    template< typename... Ts >
+    static CStep waitAll( Ts&&... futures ) {
+        return waitFor( whenAll( std::forward< Ts >( futures )... ) );
+    }
+    template< typename... Ts >
+    static CStep waitAny( Ts&&... futures ) {
+        return waitFor( whenAny( std::forward< Ts >( futures )... ) );
+    }
 
   private:
     static CIfStep infraIifImpl( const Future<bool>& b, AStep* c );
     static CStep infraWhileImpl( const Future<bool>& b, AStep* c );
+    static CParStep infraParImpl( AStep* c );
 
   public:
     static CIfStep iif( const Future<bool>& b, StepFunction fn ) {
-        CStep s( fn );
+        CStep s( std::move( fn ) );
         s.step->debugDump( "iif 0" );
         return infraIifImpl( b, s.step );
     }
@@ -250,20 +519,20 @@ class CCode {
     }
     template< typename... Ts >
     static CIfStep iif( const Future<bool>& b, StepFunction fn, Ts&&... Vals ) {
-        CStep s( fn );
-        s.step->next = CStep::chain( Vals... ).step;
+        CStep s( std::move( fn ) );
+        s.step->next = CStep::chain( std::forward< Ts >( Vals )... ).step;
         s.step->debugDump( "iif 2" );
         return infraIifImpl( b, s.step );
     }
     template< typename... Ts >
     static CIfStep iif( const Future<bool>& b, CStep s, Ts&&... Vals ) {
-        s.step->next = CStep::chain( Vals... ).step;
+        s.step->next = CStep::chain( std::forward< Ts >( Vals )... ).step;
         s.step->debugDump( "iif 3" );
         return infraIifImpl( b, s.step );
     }
 
     static CStep wwhile( const Future<bool>& b, StepFunction fn ) {
-        CStep s( fn );
+        CStep s( std::move( fn ) );
         s.step->debugDump( "while 0" );
         return infraWhileImpl( b, s.step );
     }
@@ -273,33 +542,79 @@ class CCode {
     }
     template< typename... Ts >
     static CStep wwhile( const Future<bool>& b, StepFunction fn, Ts&&... Vals ) {
-        CStep s( fn );
-        s.step->next = CStep::chain( Vals... ).step;
+        CStep s( std::move( fn ) );
+        s.step->next = CStep::chain( std::forward< Ts >( Vals )... ).step;
         s.step->debugDump( "while 2" );
         return infraWhileImpl( b, s.step );
     }
     template< typename... Ts >
     static CStep wwhile( const Future<bool>& b, CStep s, Ts&&... Vals ) {
-        s.step->next = CStep::chain( Vals... ).step;
+        s.step->next = CStep::chain( std::forward< Ts >( Vals )... ).step;
         s.step->debugDump( "while 3" );
         return infraWhileImpl( b, s.step );
     }
+
+    //Branches run concurrently (each one until it waits for something), and the step after them is executed once all of them are over
+    //  exception which is not caught within a branch doesn't stop the others: the handler (if any) is called right away,
+    //  and the program goes on beyond it once all the branches are over
+    static CParStep parallel( StepFunction fn ) {
+        CStep s( std::move( fn ) );
+        return infraParImpl( s.step );
+    }
+    static CParStep parallel( CStep s ) {
+        return infraParImpl( s.step );
+    }
+    template< typename... Ts >
+    static CParStep parallel( StepFunction fn, Ts&&... Vals ) {
+        CStep s( std::move( fn ) );
+        s.step->next = CStep::chain( std::forward< Ts >( Vals )... ).step;
+        return infraParImpl( s.step );
+    }
+    template< typename... Ts >
+    static CParStep parallel( CStep s, Ts&&... Vals ) {
+        s.step->next = CStep::chain( std::forward< Ts >( Vals )... ).step;
+        return infraParImpl( s.step );
+    }
 };
 
 }
 
-#define CCODE CCode code([=]()
+//NB: CCODE macros build programs for ACCODE_ENGINE, which MAY be redefined (even between CCODE blocks)
+//    CCode runs a linked list of AStep's; CFlatCode (see cflat.h) runs a flat instruction array;
+//    CStaticCode (see cstatic.h) keeps the whole program in its type
+#ifndef ACCODE_ENGINE
+#define ACCODE_ENGINE CCode
+#endif
+
+//NB: with ACCODE_PROFILING, each step (and each WAIT/COND/LOOP/PAR) gets the StepSite of the macro it comes from (see cprofile.h)
+#ifdef ACCODE_PROFILING
+#define ACCODE_AT ACCODE_ENGINE::infraAt( ACCODE_SITE() ) *
+#else
+#define ACCODE_AT
+#endif
+
+#define CCODE ACCODE_ENGINE code(ACCODE_AT [=]()
+//NB: CCODE_WITH and AWAIT_FOR are supported by CCode only
+#define CCODE_WITH(token) ACCODE_ENGINE code(token,ACCODE_AT [=]()
 #define ENDCCODE );
-#define TTRY },CCode::ttry([=]()
+#define TTRY },ACCODE_ENGINE::ttry(ACCODE_AT [=]()
 //NB: no starting } for CCATCH, as it ALWAYS comes after '}'
-#define CCATCH(a) ).CTryStep::ccatch([=](a)
-#define ENDTTRY ),[=](){
-#define AWAIT(a) },CCode::waitFor(a),[=](){
-#define IIF(a) },CCode::iif(a,[=]()
+#define CCATCH(a) ).ccatch([=](a)
+#define ENDTTRY ),ACCODE_AT [=](){
+#define AWAIT(a) },ACCODE_AT ACCODE_ENGINE::waitFor(a),ACCODE_AT [=](){
+#define AWAIT_FOR(a,ms) },ACCODE_AT ACCODE_ENGINE::waitFor(a,ms),ACCODE_AT [=](){
+#define IIF(a) },ACCODE_AT ACCODE_ENGINE::iif(a,ACCODE_AT [=]()
 //NB: no starting } for EELSE and for ENDIIF, as they ALWAYS come after '}'
-#define EELSE ).eelse([=]()
-#define ENDIIF ),[=](){
-#define WWHILE(a) },CCode::wwhile(a,[=]()
-#define ENDWWHILE ),[=](){
+#define EELSE ).eelse(ACCODE_AT [=]()
+#define ENDIIF ),ACCODE_AT [=](){
+#define WWHILE(a) },ACCODE_AT ACCODE_ENGINE::wwhile(a,ACCODE_AT [=]()
+#define ENDWWHILE ),ACCODE_AT [=](){
+#define AWAIT_ALL(...) },ACCODE_AT ACCODE_ENGINE::waitAll(__VA_ARGS__),ACCODE_AT [=](){
+#define AWAIT_ANY(...) },ACCODE_AT ACCODE_ENGINE::waitAny(__VA_ARGS__),ACCODE_AT [=](){
+//NB: PPARALLEL is supported by CCode only
+#define PPARALLEL },ACCODE_AT ACCODE_ENGINE::parallel(ACCODE_AT [=]()
+//NB: no starting } for AAND and for ENDPPARALLEL, as they ALWAYS come after '}'
+#define AAND ).aand(ACCODE_AT [=]()
+#define ENDPPARALLEL ),ACCODE_AT [=](){
 
 #endif
@@ -0,0 +1,438 @@
+/*******************************************************************************
+Copyright (C) 2016 OLogN Technologies AG
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*******************************************************************************/
+
+#ifndef CFLAT_H
+#define CFLAT_H
+
+#include <type_traits>
+#include <vector>
+
+#include "aassert.h"
+#include "future.h"
+#include "ccode.h"
+
+//CFlatCode: alternative CCode engine
+//  the program is lowered (while it is being built) into a contiguous array of CInstr's,
+//  which is then run by a program counter; no steps are allocated, spliced or deleted at runtime
+//  built with the same CCODE/TTRY/AWAIT/IIF/WWHILE macros, with ACCODE_ENGINE defined as CFlatCode
+//CCodeProgram< Frame >: the same, but built only once and then started any number of times (see below)
+
+namespace autom {
+
+enum class COP : unsigned char { EXEC, WAIT, COND, LOOP, JUMP, TRY };
+
+//void* is the Frame of CCodeProgram< Frame > instance (nullptr for CFlatCode)
+//  EXEC: runs the step and returns nullptr; WAIT, COND, LOOP: returns the future (see CFlatMember)
+using CFlatFunction = InlineFunction< InfraFutureBase*( void* ) >;
+using CFlatHandler = InlineFunction< void( void*, const std::exception& ) >;
+
+//Adapters from user callables; Frame == void stands for CFlatCode, where steps take no parameters
+template< typename Frame, typename F >
+struct CFlatExec {
+    F f;
+
+    explicit CFlatExec( F&& f_ ) : f( std::move( f_ ) ) {}
+    explicit CFlatExec( const F& f_ ) : f( f_ ) {}
+    InfraFutureBase* operator()( void* frame ) const {
+        f( *static_cast< Frame* >( frame ) );
+        return nullptr;
+    }
+};
+
+template< typename F >
+struct CFlatExec< void, F > {
+    F f;
+
+    explicit CFlatExec( F&& f_ ) : f( std::move( f_ ) ) {}
+    explicit CFlatExec( const F& f_ ) : f( f_ ) {}
+    InfraFutureBase* operator()( void* ) const {
+        f();
+        return nullptr;
+    }
+};
+
+template< typename Frame, typename F >
+struct CFlatCatch {
+    F f;
+
+    explicit CFlatCatch( F&& f_ ) : f( std::move( f_ ) ) {}
+    explicit CFlatCatch( const F& f_ ) : f( f_ ) {}
+    void operator()( void* frame, const std::exception& x ) const {
+        f( *static_cast< Frame* >( frame ), x );
+    }
+};
+
+template< typename F >
+struct CFlatCatch< void, F > {
+    F f;
+
+    explicit CFlatCatch( F&& f_ ) : f( std::move( f_ ) ) {}
+    explicit CFlatCatch( const F& f_ ) : f( f_ ) {}
+    void operator()( void*, const std::exception& x ) const {
+        f( x );
+    }
+};
+
+//Future which is a member of Frame
+template< typename Frame, typename F >
+struct CFlatMember {
+    F Frame::* member;
+
+    explicit CFlatMember( F Frame::* member_ ) : member( member_ ) {}
+    InfraFutureBase* operator()( void* frame ) const {
+        return ( static_cast< Frame* >( frame )->*member ).infraGetPtr();
+    }
+};
+
+//NB: all the offsets are relative to the instruction itself, so fragments are concatenated without any relocation
+struct CInstr {
+    COP op;
+    int jump = 0;//COND, LOOP: where to go if the condition is false; JUMP: where to go; TRY: end of the try block
+    int tryOff = 0;//innermost enclosing TRY (always negative), 0 if none
+    int handler = -1;//TRY: index of the handler in CFlatSteps::handlers, -1 if no ccatch()
+    InfraFutureBase* infraPtr = nullptr;//WAIT: future; COND, LOOP: InfraFuture< bool >; we hold a reference
+    CFlatFunction fn;//EXEC; also WAIT, COND, LOOP if there is no infraPtr
+
+    explicit CInstr( COP op_ ) : op( op_ ) {}
+    CInstr( COP op_, const FutureBase& future ) : op( op_ ) {
+        infraPtr = future.infraGetPtr();
+        AASSERT4( infraPtr );
+        infraPtr->refCount++;
+    }
+    CInstr( COP op_, CFlatFunction&& futureOf ) : op( op_ ), fn( std::move( futureOf ) ) {}
+    CInstr( CInstr&& other ) : op( other.op ), jump( other.jump ), tryOff( other.tryOff ), handler( other.handler ),
+        infraPtr( other.infraPtr ), fn( std::move( other.fn ) ) {
+        other.infraPtr = nullptr;
+    }
+    CInstr( const CInstr& ) = delete;
+    CInstr& operator=( const CInstr& ) = delete;
+    ~CInstr() {
+        if( infraPtr )
+            infraPtr->releaseRef();
+    }
+
+    InfraFutureBase* future( void* frame ) const {
+        AASSERT4( op == COP::WAIT || op == COP::COND || op == COP::LOOP );
+        return infraPtr ? infraPtr : fn( frame );
+    }
+    bool condition( void* frame ) const {
+        AASSERT4( op == COP::COND || op == COP::LOOP );
+        return static_cast< InfraFuture< bool >* >( future( frame ) )->getResult();
+    }
+    void debugDump( size_t pc ) const {
+        INFRATRACE4( "    {}: {} jump {} try {} handler {} infra->{}", pc, static_cast< int >( op ), jump, tryOff, handler, ( void* )infraPtr );
+    }
+};
+
+//A piece of program under construction
+class CFlatSteps {
+    friend class CFlatProgram;
+
+  protected:
+    std::vector< CInstr > code;
+    std::vector< CFlatHandler > handlers;
+
+  public:
+    CFlatSteps() {}
+    CFlatSteps( CFlatSteps&& ) = default;
+    CFlatSteps& operator=( CFlatSteps&& ) = default;
+    CFlatSteps( const CFlatSteps& ) = delete;
+    CFlatSteps& operator=( const CFlatSteps& ) = delete;
+
+    int size() const {
+        return static_cast< int >( code.size() );
+    }
+
+    void append( CFlatFunction fn ) {
+        code.push_back( CInstr( COP::EXEC ) );
+        code.back().fn = std::move( fn );
+    }
+    void append( CFlatSteps&& other );
+
+    //vs are steps (callables, see CFlatExec) and fragments (CFlatSteps)
+    template< typename Frame, typename... Ts >
+    void appendAll( Ts&& ... vs ) {
+        reserveFor( vs... );
+        appendEach< Frame >( std::forward< Ts >( vs )... );
+    }
+    //head is TRY, COND or LOOP opening the block, vs are the block itself
+    template< typename Frame, typename... Ts >
+    void infraOpen( CInstr&& head, Ts&& ... vs ) {
+        AASSERT4( code.empty() );
+        reserveFor( vs... );
+        code.push_back( std::move( head ) );
+        appendEach< Frame >( std::forward< Ts >( vs )... );
+    }
+    //to be called when the block opened by infraOpen() is complete
+    void infraEndTry();
+    void infraEndCond();
+    void infraEndLoop();
+
+  protected:
+    //NB: reserving room for all of vs plus two more (opening instruction and closing JUMP), to avoid reallocations as we go
+    template< typename... Ts >
+    void reserveFor( const Ts& ... vs ) {
+        int counts[] = { 2, countOf( vs )... };
+        size_t n = code.size();
+        for( int c : counts )
+            n += c;
+        code.reserve( n );
+    }
+    template< typename Frame >
+    void appendEach() {}
+    template< typename Frame, typename T, typename... Ts >
+    void appendEach( T&& v, Ts&& ... vs ) {
+        appendOne< Frame >( std::forward< T >( v ), std::is_base_of< CFlatSteps, typename std::decay< T >::type >() );
+        appendEach< Frame >( std::forward< Ts >( vs )... );
+    }
+
+  private:
+    template< typename Frame, typename T >
+    void appendOne( T&& s, std::true_type ) {
+        append( std::move( s ) );
+    }
+    template< typename Frame, typename F >
+    void appendOne( F&& f, std::false_type ) {
+        append( CFlatExec< Frame, typename std::decay< F >::type >( std::forward< F >( f ) ) );
+    }
+
+    static int countOf( const CFlatSteps& s ) {
+        return s.size();
+    }
+    template< typename F >
+    static int countOf( const F&, typename std::enable_if < !std::is_base_of< CFlatSteps, F >::value >::type* = nullptr ) {
+        return 1;
+    }
+};
+
+template< typename Frame >
+class CFlatIf : public CFlatSteps {
+  public:
+    //[COND] then-branch [JUMP] else-branch
+    template< typename... Ts >
+    CFlatSteps eelse( Ts&& ... vals ) {
+        AASSERT4( code[0].op == COP::COND );
+        reserveFor( vals... );
+        int jumpAt = size();
+        code.push_back( CInstr( COP::JUMP ) );
+        code[0].jump = size();
+        appendEach< Frame >( std::forward< Ts >( vals )... );
+        code[jumpAt].jump = size() - jumpAt;
+        return std::move( *this );
+    }
+};
+
+template< typename Frame >
+class CFlatTry : public CFlatSteps {
+  public:
+    template< typename F >
+    CFlatTry ccatch( F&& handler ) {
+        AASSERT4( code[0].op == COP::TRY );
+        AASSERT4( code[0].handler < 0 );
+        code[0].handler = static_cast< int >( handlers.size() );
+        handlers.push_back( CFlatCatch< Frame, typename std::decay< F >::type >( std::forward< F >( handler ) ) );
+        return std::move( *this );
+    }
+};
+
+//Complete program: instructions and catch handlers
+//  immutable once built, so it MAY be run by any number of CFlatRun's
+class CFlatProgram {
+    std::vector< CInstr > code;
+    std::vector< CFlatHandler > handlers;
+
+  public:
+    explicit CFlatProgram( CFlatSteps&& steps ) : code( std::move( steps.code ) ), handlers( std::move( steps.handlers ) ) {}
+    CFlatProgram( const CFlatProgram& ) = delete;
+    CFlatProgram& operator=( const CFlatProgram& ) = delete;
+
+    size_t size() const {
+        return code.size();
+    }
+    const CInstr& operator[]( size_t pc ) const {
+        return code[pc];
+    }
+    void handle( int handler, void* frame, const std::exception& x ) const {
+        handlers[handler]( frame, x );
+    }
+    void debugDump() const {
+        for( size_t i = 0; i < code.size(); i++ )
+            code[i].debugDump( i );
+    }
+};
+
+//Running program: program counter and Frame; deletes itself when the program ends
+class CFlatRun {
+    const CFlatProgram& program;
+    void* frame;
+    size_t pc = 0;
+
+  protected:
+    CFlatRun( const CFlatProgram& program_, void* frame_ ) : program( program_ ), frame( frame_ ) {}
+    virtual ~CFlatRun() {}
+
+  public:
+    CFlatRun( const CFlatRun& ) = delete;
+    CFlatRun& operator=( const CFlatRun& ) = delete;
+
+    void exec();
+    void wakeup( const std::exception* ex );
+
+  private:
+    bool unwind( const std::exception& x );
+};
+
+#ifdef ACCODE_PROFILING
+//CFlatCode steps are not profiled (yet), so ACCODE_AT leaves them as they are
+struct CFlatNoSite {
+    template< typename T >
+    typename std::decay< T >::type operator*( T&& t ) const {
+        return std::forward< T >( t );
+    }
+};
+#endif
+
+//Static builders shared by CFlatCode and CCodeProgram< Frame >
+template< typename Frame >
+class CFlatBuilder {
+  public:
+#ifdef ACCODE_PROFILING
+    static CFlatNoSite infraAt( StepSite* ) {
+        return CFlatNoSite();
+    }
+#endif
+    template< typename... Ts >
+    static CFlatSteps infraSteps( Ts&& ... vals ) {
+        CFlatSteps s;
+        s.appendAll< Frame >( std::forward< Ts >( vals )... );
+        return s;
+    }
+
+    template< typename... Ts >
+    static CFlatTry< Frame > ttry( Ts&& ... vals ) {
+        CFlatTry< Frame > s;
+        s.template infraOpen< Frame >( CInstr( COP::TRY ), std::forward< Ts >( vals )... );
+        s.infraEndTry();
+        return s;
+    }
+    static CFlatSteps waitFor( const FutureBase& future ) {
+        CFlatSteps s;
+        s.infraOpen< Frame >( CInstr( COP::WAIT, future ) );
+        return s;
+    }
+    template< typename... Ts >
+    static CFlatSteps waitAll( Ts&& ... futures ) {
+        return waitFor( whenAll( std::forward< Ts >( futures )... ) );
+    }
+    template< typename... Ts >
+    static CFlatSteps waitAny( Ts&& ... futures ) {
+        return waitFor( whenAny( std::forward< Ts >( futures )... ) );
+    }
+    //[COND] branch
+    template< typename... Ts >
+    static CFlatIf< Frame > iif( const Future<bool>& b, Ts&& ... vals ) {
+        CFlatIf< Frame > s;
+        s.template infraOpen< Frame >( CInstr( COP::COND, b ), std::forward< Ts >( vals )... );
+        s.infraEndCond();
+        return s;
+    }
+    //[LOOP] body [JUMP back to LOOP]
+    template< typename... Ts >
+    static CFlatSteps wwhile( const Future<bool>& b, Ts&& ... vals ) {
+        CFlatSteps s;
+        s.infraOpen< Frame >( CInstr( COP::LOOP, b ), std::forward< Ts >( vals )... );
+        s.infraEndLoop();
+        return s;
+    }
+};
+
+class CFlatCode : public CFlatBuilder< void > {
+    class Run : public CFlatRun {
+        CFlatProgram own;
+
+      public:
+        explicit Run( CFlatSteps&& s ) : CFlatRun( own, nullptr ), own( std::move( s ) ) {
+            own.debugDump();
+        }
+    };
+
+  public:
+    template< typename... Ts >
+    CFlatCode( Ts&& ... vals ) {
+        ( new Run( infraSteps( std::forward< Ts >( vals )... ) ) )->exec();
+    }
+};
+
+//Program built once (such as at startup), and started any number of times, each time with its own Frame
+//  steps are called as f( Frame& ), and ccatch() handlers - as f( Frame&, const std::exception& )
+//  futures which are different for each instance are Frame members, given to waitFor()/iif()/wwhile() as &Frame::member
+//  each start() costs one allocation (of Frame plus program counter), and nothing else
+//  CCodeProgram MUST outlive all the instances it has started
+template< typename Frame >
+class CCodeProgram : public CFlatBuilder< Frame > {
+    using Builder = CFlatBuilder< Frame >;
+
+    class Run : public CFlatRun {
+        Frame frame;
+
+      public:
+        template< typename... Args >
+        explicit Run( const CFlatProgram& p, Args&& ... args ) : CFlatRun( p, &frame ), frame( std::forward< Args >( args )... ) {}
+    };
+
+    CFlatProgram program;
+
+  public:
+    template< typename... Ts >
+    explicit CCodeProgram( Ts&& ... vals ) : program( Builder::infraSteps( std::forward< Ts >( vals )... ) ) {
+        program.debugDump();
+    }
+    CCodeProgram( const CCodeProgram& ) = delete;
+    CCodeProgram& operator=( const CCodeProgram& ) = delete;
+
+    //args are passed to Frame constructor
+    template< typename... Args >
+    void start( Args&& ... args ) const {
+        ( new Run( program, std::forward< Args >( args )... ) )->exec();
+    }
+
+    using Builder::waitFor;
+    using Builder::iif;
+    using Builder::wwhile;
+
+    template< typename F >
+    static CFlatSteps waitFor( F Frame::* future ) {
+        CFlatSteps s;
+        s.infraOpen< Frame >( CInstr( COP::WAIT, CFlatMember< Frame, F >( future ) ) );
+        return s;
+    }
+    template< typename... Ts >
+    static CFlatIf< Frame > iif( Future<bool> Frame::* b, Ts&& ... vals ) {
+        CFlatIf< Frame > s;
+        s.template infraOpen< Frame >( CInstr( COP::COND, CFlatMember< Frame, Future<bool> >( b ) ), std::forward< Ts >( vals )... );
+        s.infraEndCond();
+        return s;
+    }
+    template< typename... Ts >
+    static CFlatSteps wwhile( Future<bool> Frame::* b, Ts&& ... vals ) {
+        CFlatSteps s;
+        s.infraOpen< Frame >( CInstr( COP::LOOP, CFlatMember< Frame, Future<bool> >( b ) ), std::forward< Ts >( vals )... );
+        s.infraEndLoop();
+        return s;
+    }
+};
+
+}
+
+#endif
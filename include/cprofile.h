@@ -0,0 +1,108 @@
+/*******************************************************************************
+Copyright (C) 2016 OLogN Technologies AG
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*******************************************************************************/
+
+#ifndef CPROFILE_H
+#define CPROFILE_H
+
+#include <chrono>
+#include <cstdint>
+
+//NB: CCode profiler is compiled in only with ACCODE_PROFILING defined (for the whole build, as it changes AStep);
+//    otherwise, CCODE macros don't tag steps at all, and StepSite::report() just says so
+namespace autom {
+
+//Log2 histogram of durations: bucket i holds [2^i, 2^(i+1)) ns (bucket 0 holds 0 too, and the last one - everything above)
+//  fixed size, so that add() is a few instructions
+class InfraHistogram {
+  public:
+    static const int BUCKETS = 40;//2^40 ns is about 18 minutes
+
+    uint64_t count = 0;
+    uint64_t total = 0;
+    uint64_t max = 0;
+    uint64_t buckets[BUCKETS] = {};
+
+    void add( uint64_t ns ) {
+        ++count;
+        total += ns;
+        if( ns > max )
+            max = ns;
+        int i = 0;
+        for( uint64_t v = ns >> 1; v && i < BUCKETS - 1; v >>= 1 )
+            ++i;
+        ++buckets[i];
+    }
+    //Upper bound of the bucket where fraction p of the durations ends
+    uint64_t percentile( double p ) const;
+    void reset() {
+        *this = InfraHistogram();
+    }
+};
+
+//Source location of a CCode step (one per macro expansion per thread, see ACCODE_AT in ccode.h), with what the profiler knows about it
+//  shared by all the programs built at that place by the thread, so nothing is looked up at run time
+//  NB: as programs run within the thread of their Node (where they are built), each thread has its own counters,
+//      and updates them without any synchronization; report() covers the calling thread
+class StepSite {
+    StepSite* nextSite;//all the sites seen so far by the thread
+
+  public:
+    const char* file;
+    int line;
+    char op = ' ';//AStep opcode
+    const StepSite* program = nullptr;//site of the CCODE which has started it first
+    InfraHistogram run;//CPU time of executing the step (of the thread, so time the step spends blocked is not there)
+    InfraHistogram wait;//WAIT: wall time from being reached to its future being ready (or to being torn down)
+
+    StepSite( const char* file_, int line_ );
+    StepSite( const StepSite& ) = delete;
+    StepSite& operator=( const StepSite& ) = delete;
+
+    //Logs steps of each program run by the calling thread, the ones with most time spent in them first (programs are ranked the same way)
+    static void report();
+    static void reset();
+    //Site of the calling thread at file:line (file as __FILE__ gives it) with AStep opcode op, if any
+    //  NB: most of CCODE macros have two sites at the same line, such as AWAIT: its WAIT, and the step after it
+    static const StepSite* find( const char* file, int line, char op );
+};
+
+//Wall time, ns
+inline uint64_t infraProfileNow() {
+    return std::chrono::duration_cast< std::chrono::nanoseconds >( std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+//CPU time of the calling thread, ns (NB: the resolution is up to the OS, such as 100ns units on Windows, updated once per tick)
+uint64_t infraProfileCpuNow();
+
+//Adds CPU time of the thread from construction to destruction to h (if any)
+class InfraProfileTimer {
+    InfraHistogram* h;
+    uint64_t started;
+
+  public:
+    explicit InfraProfileTimer( InfraHistogram* h_ ) : h( h_ ), started( h_ ? infraProfileCpuNow() : 0 ) {}
+    InfraProfileTimer( const InfraProfileTimer& ) = delete;
+    InfraProfileTimer& operator=( const InfraProfileTimer& ) = delete;
+    ~InfraProfileTimer() {
+        if( h )
+            h->add( infraProfileCpuNow() - started );
+    }
+};
+
+}
+
+//Site of the current macro expansion; NB: function-local thread_local, so it is constructed (and registered) once per thread, on first use
+#define ACCODE_SITE() ( []() -> autom::StepSite* { static thread_local autom::StepSite site( __FILE__, __LINE__ ); return &site; }() )
+
+#endif
@@ -0,0 +1,391 @@
+/*******************************************************************************
+Copyright (C) 2016 OLogN Technologies AG
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*******************************************************************************/
+
+#ifndef CSTATIC_H
+#define CSTATIC_H
+
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "aassert.h"
+#include "future.h"
+#include "ccode.h"
+
+//CStaticCode: alternative CCode engine for programs whose structure is known at compile time
+//  the program is a tree of types (CStaticSeq, CStaticTry, ...) holding the user lambdas as they are (no StepFunction, no AStep),
+//  so steps are direct (and usually inlined) calls, and the whole running program is a single object (one allocation per CCODE)
+//  a WAIT which is to be resumed is identified by its path in the tree (CStaticPath), again at compile time
+//  built with the same CCODE/TTRY/AWAIT/IIF/WWHILE macros, with ACCODE_ENGINE defined as CStaticCode (no PPARALLEL, no AWAIT_FOR)
+
+namespace autom {
+
+//DONE: the node is over; WAITING: a WAIT within it waits (and will resume it); FAILED: a future has failed (see CStaticRun::failure)
+enum class CStaticState { DONE, WAITING, FAILED };
+
+//Path from the program root to a node: index of the child at each level
+template< int... Is >
+struct CStaticPath {};
+
+template< typename Path, int I >
+struct CStaticAppend;
+
+template< int... Is, int I >
+struct CStaticAppend< CStaticPath< Is... >, I > {
+    using type = CStaticPath< Is..., I >;
+};
+
+//Base of all the nodes; anything else within a program is a step (see CStaticExec)
+struct CStaticNode {};
+
+//Reference to the future of WAIT, IIF or WWHILE
+class CStaticRef {
+  protected:
+    InfraFutureBase* infraPtr;
+
+  public:
+    explicit CStaticRef( const FutureBase& future ) : infraPtr( future.infraGetPtr() ) {
+        AASSERT4( infraPtr );
+        infraPtr->refCount++;
+    }
+    CStaticRef( CStaticRef&& other ) : infraPtr( other.infraPtr ) {
+        other.infraPtr = nullptr;
+    }
+    CStaticRef( const CStaticRef& other ) : infraPtr( other.infraPtr ) {
+        infraPtr->refCount++;
+    }
+    CStaticRef& operator=( const CStaticRef& ) = delete;
+    ~CStaticRef() {
+        if( infraPtr )
+            infraPtr->releaseRef();
+    }
+
+    bool condition() const {
+        return static_cast< InfraFuture< bool >* >( infraPtr )->getResult();
+    }
+};
+
+template< typename F >
+class CStaticExec : public CStaticNode {
+    F f;
+
+  public:
+    explicit CStaticExec( F&& f_ ) : f( std::move( f_ ) ) {}
+    explicit CStaticExec( const F& f_ ) : f( f_ ) {}
+
+    template< typename Run, typename Path >
+    CStaticState run( Run& ) {
+        f();
+        return CStaticState::DONE;
+    }
+};
+
+//NB: wakeup goes to Run::wakeup< Path >(), which resumes the program right at this WAIT
+template< typename Run, typename Path >
+struct CStaticWakeup {
+    Run* r;
+
+    explicit CStaticWakeup( Run* r_ ) : r( r_ ) {}
+    void operator()( const std::exception* ex ) const {
+        r->template wakeup< Path >( ex );
+    }
+};
+
+class CStaticWait : public CStaticNode, private CStaticRef {
+  public:
+    explicit CStaticWait( const FutureBase& future ) : CStaticRef( future ) {}
+
+    template< typename Run, typename Path >
+    CStaticState run( Run& r ) {
+        if( infraPtr->isDataReady() )
+            return CStaticState::DONE;
+        if( infraPtr->isFailed() ) {
+            //NB: it has failed before we got here, and won't fire again
+            r.failure = &infraPtr->infraGetError();
+            return CStaticState::FAILED;
+        }
+        INFRATRACE4( "CStaticRun {}: waiting event {}", ( void* )&r, ( void* )infraPtr );
+        infraPtr->infraAddThen( CStaticWakeup< Run, Path >( &r ) );
+        return CStaticState::WAITING;
+    }
+    template< typename Run, typename Path >
+    CStaticState resume( Run& r, CStaticPath<> ) {
+        return r.failure ? CStaticState::FAILED : CStaticState::DONE;
+    }
+};
+
+//Steps and nodes, one after another
+template< typename... Ts >
+class CStaticSeq : public CStaticNode {
+    template< typename... Us >
+    friend class CStaticSeq;
+
+    std::tuple< Ts... > items;
+
+  public:
+    CStaticSeq() {}
+    template< typename... Us >
+    explicit CStaticSeq( Us&& ... vals ) : items( std::forward< Us >( vals )... ) {}
+
+    template< typename Run, typename Path >
+    CStaticState run( Run& r ) {
+        return runFrom< Run, Path, 0 >( r, std::integral_constant < bool, 0 < sizeof...( Ts ) > () );
+    }
+    template< typename Run, typename Path, int I, int... Rest >
+    CStaticState resume( Run& r, CStaticPath< I, Rest... > ) {
+        CStaticState st = std::get< I >( items ).template resume< Run, typename CStaticAppend< Path, I >::type >( r, CStaticPath< Rest... >() );
+        if( st != CStaticState::DONE )
+            return st;
+        return runFrom < Run, Path, I + 1 > ( r, std::integral_constant < bool, I + 1 < sizeof...( Ts ) > () );
+    }
+
+  private:
+    template< typename Run, typename Path, int I >
+    CStaticState runFrom( Run& r, std::true_type ) {
+        CStaticState st = std::get< I >( items ).template run< Run, typename CStaticAppend< Path, I >::type >( r );
+        if( st != CStaticState::DONE )
+            return st;
+        return runFrom < Run, Path, I + 1 > ( r, std::integral_constant < bool, I + 1 < sizeof...( Ts ) > () );
+    }
+    template< typename Run, typename Path, int I >
+    CStaticState runFrom( Run&, std::false_type ) {
+        return CStaticState::DONE;
+    }
+};
+
+//Node as it is, anything else as a step
+template< typename T, bool isNode = std::is_base_of< CStaticNode, T >::value >
+struct CStaticItem {
+    using type = T;
+};
+
+template< typename T >
+struct CStaticItem< T, false > {
+    using type = CStaticExec< T >;
+};
+
+template< typename... Ts >
+using CStaticSeqOf = CStaticSeq< typename CStaticItem< typename std::decay< Ts >::type >::type... >;
+
+//Handler of TTRY without CCATCH: exceptions go further up
+struct CStaticNoCatch {};
+
+template< typename Body, typename Handler >
+class CStaticTry : public CStaticNode {
+    template< typename B, typename H >
+    friend class CStaticTry;
+
+    Body body;
+    Handler handler;
+
+  public:
+    CStaticTry( Body&& body_, Handler&& handler_ ) : body( std::move( body_ ) ), handler( std::move( handler_ ) ) {}
+
+    template< typename F >
+    CStaticTry< Body, typename std::decay< F >::type > ccatch( F&& h ) {
+        static_assert( std::is_same< Handler, CStaticNoCatch >::value, "CStaticTry: ccatch() MUST come only once" );
+        return CStaticTry< Body, typename std::decay< F >::type >( std::move( body ), typename std::decay< F >::type( std::forward< F >( h ) ) );
+    }
+
+    template< typename Run, typename Path >
+    CStaticState run( Run& r ) {
+        return guard( r, [ & ]() {
+            return body.template run< Run, typename CStaticAppend< Path, 0 >::type >( r );
+        }, std::is_same< Handler, CStaticNoCatch >() );
+    }
+    template< typename Run, typename Path, int... Rest >
+    CStaticState resume( Run& r, CStaticPath< 0, Rest... > ) {
+        return guard( r, [ & ]() {
+            return body.template resume< Run, typename CStaticAppend< Path, 0 >::type >( r, CStaticPath< Rest... >() );
+        }, std::is_same< Handler, CStaticNoCatch >() );
+    }
+
+  private:
+    template< typename Run, typename F >
+    CStaticState guard( Run& r, F&& f, std::false_type ) {
+        CStaticState st;
+        try {
+            st = f();
+        } catch( const std::exception& x ) {
+            handler( x );
+            return CStaticState::DONE;
+        }
+        if( st == CStaticState::FAILED ) {
+            const std::exception* x = r.failure;
+            r.failure = nullptr;
+            handler( *x );
+            return CStaticState::DONE;
+        }
+        return st;
+    }
+    template< typename Run, typename F >
+    CStaticState guard( Run&, F&& f, std::true_type ) {
+        return f();
+    }
+};
+
+//[COND] then-branch (child 0), else-branch (child 1)
+template< typename Then, typename Else >
+class CStaticIf : public CStaticNode, private CStaticRef {
+    template< typename T, typename E >
+    friend class CStaticIf;
+
+    Then thenBranch;
+    Else elseBranch;
+
+  public:
+    CStaticIf( CStaticRef&& cond, Then&& then_, Else&& else_ ) : CStaticRef( std::move( cond ) ), thenBranch( std::move( then_ ) ),
+        elseBranch( std::move( else_ ) ) {}
+
+    template< typename... Ts >
+    CStaticIf< Then, CStaticSeqOf< Ts... > > eelse( Ts&& ... vals ) {
+        static_assert( std::is_same< Else, CStaticSeq<> >::value, "CStaticIf: eelse() MUST come only once" );
+        return CStaticIf< Then, CStaticSeqOf< Ts... > >( static_cast< CStaticRef&& >( *this ), std::move( thenBranch ), CStaticSeqOf< Ts... >( std::forward< Ts >( vals )... ) );
+    }
+
+    template< typename Run, typename Path >
+    CStaticState run( Run& r ) {
+        if( condition() )
+            return thenBranch.template run< Run, typename CStaticAppend< Path, 0 >::type >( r );
+        return elseBranch.template run< Run, typename CStaticAppend< Path, 1 >::type >( r );
+    }
+    template< typename Run, typename Path, int... Rest >
+    CStaticState resume( Run& r, CStaticPath< 0, Rest... > ) {
+        return thenBranch.template resume< Run, typename CStaticAppend< Path, 0 >::type >( r, CStaticPath< Rest... >() );
+    }
+    template< typename Run, typename Path, int... Rest >
+    CStaticState resume( Run& r, CStaticPath< 1, Rest... > ) {
+        return elseBranch.template resume< Run, typename CStaticAppend< Path, 1 >::type >( r, CStaticPath< Rest... >() );
+    }
+};
+
+//[LOOP] body (child 0); NB: iterations are a plain loop, so the stack doesn't grow with them
+template< typename Body >
+class CStaticLoop : public CStaticNode, private CStaticRef {
+    Body body;
+
+  public:
+    CStaticLoop( CStaticRef&& cond, Body&& body_ ) : CStaticRef( std::move( cond ) ), body( std::move( body_ ) ) {}
+
+    template< typename Run, typename Path >
+    CStaticState run( Run& r ) {
+        while( condition() ) {
+            CStaticState st = body.template run< Run, typename CStaticAppend< Path, 0 >::type >( r );
+            if( st != CStaticState::DONE )
+                return st;
+        }
+        return CStaticState::DONE;
+    }
+    template< typename Run, typename Path, int... Rest >
+    CStaticState resume( Run& r, CStaticPath< 0, Rest... > ) {
+        CStaticState st = body.template resume< Run, typename CStaticAppend< Path, 0 >::type >( r, CStaticPath< Rest... >() );
+        if( st != CStaticState::DONE )
+            return st;
+        return run< Run, Path >( r );
+    }
+};
+
+//Running program; deletes itself when the program is over
+//  exception which is not caught within the program just ends it (same as for CFlatCode)
+template< typename Program >
+class CStaticRun {
+    Program program;
+
+  public:
+    const std::exception* failure = nullptr;//failure of the future being resumed (see CStaticWait::resume())
+
+    explicit CStaticRun( Program&& program_ ) : program( std::move( program_ ) ) {}
+    CStaticRun( const CStaticRun& ) = delete;
+    CStaticRun& operator=( const CStaticRun& ) = delete;
+
+    void exec() {
+        CStaticState st;
+        try {
+            st = program.template run< CStaticRun, CStaticPath<> >( *this );
+        } catch( const std::exception& ) {
+            st = CStaticState::FAILED;
+        }
+        finish( st );
+    }
+    template< typename Path >
+    void wakeup( const std::exception* ex ) {
+        failure = ex;
+        CStaticState st;
+        try {
+            st = program.template resume< CStaticRun, CStaticPath<> >( *this, Path() );
+        } catch( const std::exception& ) {
+            st = CStaticState::FAILED;
+        }
+        finish( st );
+    }
+
+  private:
+    void finish( CStaticState st ) {
+        if( st == CStaticState::WAITING )
+            return;
+        INFRATRACE4( "CStaticRun {}: done", ( void* )this );
+        delete this;
+    }
+};
+
+#ifdef ACCODE_PROFILING
+//CStaticCode steps are not profiled (yet), so ACCODE_AT leaves them as they are
+struct CStaticNoSite {
+    template< typename T >
+    typename std::decay< T >::type operator*( T&& t ) const {
+        return std::forward< T >( t );
+    }
+};
+#endif
+
+class CStaticCode {
+  public:
+    template< typename... Ts >
+    CStaticCode( Ts&& ... vals ) {
+        ( new CStaticRun< CStaticSeqOf< Ts... > >( CStaticSeqOf< Ts... >( std::forward< Ts >( vals )... ) ) )->exec();
+    }
+
+#ifdef ACCODE_PROFILING
+    static CStaticNoSite infraAt( StepSite* ) {
+        return CStaticNoSite();
+    }
+#endif
+    template< typename... Ts >
+    static CStaticTry< CStaticSeqOf< Ts... >, CStaticNoCatch > ttry( Ts&& ... vals ) {
+        return CStaticTry< CStaticSeqOf< Ts... >, CStaticNoCatch >( CStaticSeqOf< Ts... >( std::forward< Ts >( vals )... ), CStaticNoCatch() );
+    }
+    static CStaticWait waitFor( const FutureBase& future ) {
+        return CStaticWait( future );
+    }
+    template< typename... Ts >
+    static CStaticWait waitAll( Ts&& ... futures ) {
+        return waitFor( whenAll( std::forward< Ts >( futures )... ) );
+    }
+    template< typename... Ts >
+    static CStaticWait waitAny( Ts&& ... futures ) {
+        return waitFor( whenAny( std::forward< Ts >( futures )... ) );
+    }
+    template< typename... Ts >
+    static CStaticIf< CStaticSeqOf< Ts... >, CStaticSeq<> > iif( const Future<bool>& b, Ts&& ... vals ) {
+        return CStaticIf< CStaticSeqOf< Ts... >, CStaticSeq<> >( CStaticRef( b ), CStaticSeqOf< Ts... >( std::forward< Ts >( vals )... ), CStaticSeq<>() );
+    }
+    template< typename... Ts >
+    static CStaticLoop< CStaticSeqOf< Ts... > > wwhile( const Future<bool>& b, Ts&& ... vals ) {
+        return CStaticLoop< CStaticSeqOf< Ts... > >( CStaticRef( b ), CStaticSeqOf< Ts... >( std::forward< Ts >( vals )... ) );
+    }
+};
+
+}
+
+#endif
@@ -16,22 +16,45 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #define FUTURE_H
 
 #include <unordered_map>
-#include <functional>
 #include <memory>
+#include <new>
+#include <string>
+#include <vector>
 
 #include "aassert.h"
+#include "aerror.h"
 #include "anode.h"
 #include "../libsrc/infra/infraconsole.h"
 
 namespace autom {
 
+class InfraFutureGroup;
+
 class InfraFutureBase {
+    friend class Node;
+    friend class InfraFutureGroup;
+
     bool dataReady;
+    bool releaseQueued = false;
+    //What infraFire() has been called with, for continuations and WAIT's which come afterwards (see Future::then())
+    //  an error is kept as ErrorStatus with its code and message; an exception which is not an ErrorStatus gets code 0
+    bool fired = false;
+    bool failed = false;
+    ErrorStatus error{ 0, nullptr };//valid if failed
+    std::string errorMessage;//what() of an exception which is not an ErrorStatus, as error only points to it
+    InfraFutureGroup* group = nullptr;//whenAll()/whenAny() this future is a member of
+    size_t groupIdx = 0;
 
   public:
     FutureFunction fn;
+    std::unique_ptr< std::vector< FutureFunction > > moreFns;
+    //SharedFuture continuations after the first one (which is always in fn)
+    //  spilled to the heap only when there is more than one subscriber
     int refCount;
+    bool thenRef = false;//fn holds a reference to us, released by cleanup()
     bool multi;
+    Node* node = nullptr;
+    FutureId id = 0;
 
     InfraFutureBase() : dataReady( false ) {}
     virtual ~InfraFutureBase() {}
@@ -41,28 +64,108 @@ class InfraFutureBase {
     bool isDataReady() const {
         return dataReady;
     }
+    bool isFired() const {
+        return fired;
+    }
+    bool isFailed() const {
+        return failed;
+    }
+    //NB: valid as long as the InfraFuture is there
+    const ErrorStatus& infraGetError() const {
+        AASSERT4( failed );
+        return error;
+    }
+    void infraFire( const std::exception* ex ) {
+        fired = true;
+        failed = !!ex;
+        if( ex ) {
+            int code = errorCode( *ex );
+            if( !code ) {
+                errorMessage = ex->what();
+                error = ErrorStatus( 0, errorMessage.c_str() );
+            } else {
+                error = ErrorStatus( code, ex->what() );
+            }
+        }
+        //NB: taking moreFns out first, as continuations MAY subscribe more while we're here (they are called right away, see SharedFuture::then())
+        auto more = std::move( moreFns );
+        if( fn )
+            fn( ex );
+        if( more ) {
+            for( auto& f : *more )
+                f( ex );
+        }
+        if( group )
+            infraNotifyGroup( ex );
+    }
+    //Calls f the way infraFire() has called the continuations which were there by then
+    void infraCallFired( const FutureFunction& f ) const {
+        AASSERT4( fired );
+        f( failed ? &error : nullptr );
+    }
+    void infraTakeThenRef() {
+        if( !thenRef ) {
+            thenRef = true;
+            refCount++;
+        }
+    }
+    //Adds a continuation, keeping the ones already there (see SharedFuture)
+    void infraAddThen( FutureFunction f ) {
+        if( !fn ) {
+            fn = std::move( f );
+            infraTakeThenRef(); // NOTE: single reference for all the continuations, see cleanup()
+        } else {
+            if( !moreFns )
+                moreFns.reset( new std::vector< FutureFunction > );
+            moreFns->push_back( std::move( f ) );
+        }
+    }
+    void releaseRef() {
+        AASSERT4( refCount > 0 );
+        if( --refCount <= 0 )
+            queueRelease();
+    }
     void cleanup() {
         if( multi )
             return;
         fn = nullptr;
+        moreFns = nullptr;
         //The line above effectively destroys existing lambda it->second.fn
         //  First, we CAN do it, as we don't need second.fn anymore at all
         //  Second, we SHOULD do it, to avoid cyclical references from lambda
         //    to our InfraFutures, which will prevent futureCleanup() from
         //    destroying InfraFuture - EVER
-        refCount--;
+        if( thenRef ) {
+            thenRef = false;
+            releaseRef();
+        }
         INFRATRACE4( "    cleanup {} cnt {}", ( void* )this, refCount );
     }
     void cleanupMulti() {
         if( multi ) {
             fn = nullptr;
+            moreFns = nullptr;
             multi = false;
             INFRATRACE4( "    multi cleanup {} cnt {}", ( void* )this, refCount );
+            if( refCount <= 0 )
+                queueRelease();
         } else {
             cleanup();
         }
     }
     virtual void debugDump() const = 0;
+    virtual size_t infraSize() const = 0;
+
+  private:
+    void infraNotifyGroup( const std::exception* ex );
+    //Actual destruction is deferred until Node::futureCleanup(),
+    //  as we may be deep within this InfraFuture's own fn() right now
+    void queueRelease() {
+        if( multi || releaseQueued )
+            return;
+        releaseQueued = true;
+        node->infraQueueRelease( this );
+    }
 };
 
 template< typename T >
@@ -81,12 +184,28 @@ class InfraFuture : public InfraFutureBase {
     void debugDump() const override {
         INFRATRACE4( "    {} refcnt {} {}", ( void* )this, refCount, multi );
     }
+    size_t infraSize() const override {
+        return sizeof( *this );
+    }
 };
 
+//InfraFutures are allocated from per-Node pool; see InfraFutureSlotMap::erase() for the other side
+template< typename F, typename... Args >
+F* infraNewFutureOf( Node* node, Args&& ... args ) {
+    static_assert( alignof( F ) <= InfraFuturePool::GRANULARITY, "InfraFuture is over-aligned for InfraFuturePool" );
+    void* p = node->infraFuturePool().allocate( sizeof( F ) );
+    return new( p ) F( std::forward< Args >( args )... );
+}
+
+template< typename T >
+InfraFuture< T >* infraNewFuture( Node* node ) {
+    return infraNewFutureOf< InfraFuture< T > >( node );
+}
+
 class FutureBase {
   public:
     virtual InfraFutureBase* infraGetPtr() const = 0;
-    virtual void then( const FutureFunction& ) const = 0;
+    virtual void then( FutureFunction ) const = 0;
 };
 
 template< typename T >
@@ -97,37 +216,47 @@ class Future : public FutureBase {
 
   public:
     explicit Future( Node* );
+    Future( Node*, InfraFuture< T >* );//f MUST be allocated from node's pool (see infraNewFutureOf())
     Future();
     Future( const Future& );
     Future( Future&& );
     Future& operator=( const Future& );
+    Future& operator=( Future&& );
     ~Future();
-    void then( const FutureFunction& ) const override;
+    void then( FutureFunction ) const override;
     void setValue( const T& v ) const {
         infraPtr->infraGetData() = v;
         infraPtr->setDataReady();
     }
+    void setValue( T&& v ) const {
+        infraPtr->infraGetData() = std::move( v );
+        infraPtr->setDataReady();
+    }
+    //NB: result is default-constructed together with InfraFuture, so emplace() is a move-assignment of T( args... )
+    template< typename... Args >
+    void emplace( Args&& ... args ) const {
+        infraPtr->infraGetData() = T( std::forward< Args >( args )... );
+        infraPtr->setDataReady();
+    }
     FutureId infraGetId() const {
         return futureId;
     }
     InfraFutureBase* infraGetPtr() const override {
         return infraPtr;
     }
-    void infraAssign( const Future& other ) const {
-        AASSERT4( 0 == futureId );
-        AASSERT4( node == other.node );
-        *infraPtr = *other.infraPtr;
-    };
     const T& value() const;
 };
 
 template< typename T >
-Future< T >::Future( Node* node_ ) : node( node_ ) {
-    futureId = node->nextFutureId();
-    auto f = new InfraFuture< T >;
+Future< T >::Future( Node* node_ ) : Future( node_, infraNewFuture< T >( node_ ) ) {
+}
+
+template< typename T >
+Future< T >::Future( Node* node_, InfraFuture< T >* f ) : node( node_ ) {
     f->refCount = 1;
     f->multi = false;
-    infraPtr = static_cast<InfraFuture< T >*>( node->insertInfraFuture( futureId, f ) );
+    futureId = node->insertInfraFuture( f );
+    infraPtr = f;
 }
 
 template<typename T>
@@ -140,60 +269,197 @@ inline Future<T>::Future() {
 template< typename T >
 Future< T >::Future( const Future& other ) :
     futureId( other.futureId ), node( other.node ), infraPtr( other.infraPtr ) {
-    AASSERT4( infraPtr == node->findInfraFuture( futureId ) );
-    infraPtr->refCount++;
+    if( infraPtr ) {
+        AASSERT5( infraPtr == node->findInfraFuture( futureId ) );
+        infraPtr->refCount++;
+    }
 }
 
 template< typename T >
 Future< T >& Future< T >::operator=( const Future& other ) {
+    if( this == &other )
+        return *this;
+    if( other.infraPtr ) {
+        AASSERT5( other.infraPtr == other.node->findInfraFuture( other.futureId ) );
+        other.infraPtr->refCount++;
+    }
+    if( infraPtr )
+        infraPtr->releaseRef();
     futureId = other.futureId;
     node = other.node;
     infraPtr = other.infraPtr;
-    AASSERT4( infraPtr == node->findInfraFuture( futureId ) );
-    infraPtr->refCount++;
     return *this;
 }
 
+//Moves steal the reference: no refCount traffic, and the source becomes an empty Future
 template< typename T >
 Future< T >::Future( Future&& other ) :
     futureId( other.futureId ), node( other.node ), infraPtr( other.infraPtr ) {
-    AASSERT4( infraPtr == node->findInfraFuture( futureId ) );
-    infraPtr->refCount++;
+    other.futureId = 0;
+    other.node = nullptr;
+    other.infraPtr = nullptr;
+}
+
+template< typename T >
+Future< T >& Future< T >::operator=( Future&& other ) {
+    if( this == &other )
+        return *this;
+    if( infraPtr )
+        infraPtr->releaseRef();
+    futureId = other.futureId;
+    node = other.node;
+    infraPtr = other.infraPtr;
+    other.futureId = 0;
+    other.node = nullptr;
+    other.infraPtr = nullptr;
+    return *this;
 }
 
 template< typename T >
 Future< T >::~Future() {
     // TODO: check ( infraPtr == node->findInfraFuture( futureId ) )
-    infraPtr->refCount--;
+    if( infraPtr )
+        infraPtr->releaseRef();
 }
 
+//NB: continuation of a future which has fired already (such as whenAll() of the futures which are all ready) is called right away,
+//    as there is nothing to call it later
 template< typename T >
-void Future< T >::then( const FutureFunction& fn ) const {
-    AASSERT4( infraPtr == node->findInfraFuture( futureId ) );
-    infraPtr->fn = fn;
-    infraPtr->refCount++; // NOTE: see corresponding refCount-- in InfraFutureBase::cleanup()
+void Future< T >::then( FutureFunction fn ) const {
+    AASSERT4( infraPtr, "then() on an empty (moved-from?) Future" );
+    AASSERT5( infraPtr == node->findInfraFuture( futureId ) );
+    if( infraPtr->isFired() ) {
+        infraPtr->infraCallFired( fn );
+        return;
+    }
+    infraPtr->fn = std::move( fn );
+    infraPtr->infraTakeThenRef(); // NOTE: see corresponding releaseRef() in InfraFutureBase::cleanup()
 }
 
 template< typename T >
 const T& Future< T >::value() const {
-    AASSERT4( infraPtr == node->findInfraFuture( futureId ) );
+    AASSERT4( infraPtr, "value() on an empty (moved-from?) Future" );
+    AASSERT5( infraPtr == node->findInfraFuture( futureId ) );
     return infraPtr->getResult();
 }
 
+//Aggregate of futures for whenAll()/whenAny(); it is also the InfraFuture of the resulting Future< size_t >
+//  each pending member points to the group (instead of having its own continuation)
+//  and holds a reference to it; the group holds a reference to each pending member
+//  member references are released as soon as the member completes
+class InfraFutureGroup : public InfraFuture< size_t > {
+    std::vector< InfraFutureBase* > members;//indexed by position in whenAll()/whenAny(); nullptr if not pending
+    size_t pending = 0;
+    bool any;
+    bool done = false;
+
+    void complete( size_t value, const std::exception* ex );
+    void detach( InfraFutureBase* f );
+
+  public:
+    explicit InfraFutureGroup( bool any_ ) : any( any_ ) {}
+
+    void add( InfraFutureBase* f );
+    void infraMemberFired( InfraFutureBase* f, const std::exception* ex );
+    void infraSetupDone();
+
+    void debugDump() const override {
+        INFRATRACE4( "    {} refcnt {} group {} pending {}/{}", ( void* )this, refCount, any ? "any" : "all", pending, members.size() );
+    }
+    size_t infraSize() const override {
+        return sizeof( *this );
+    }
+};
+
+inline void InfraFutureBase::infraNotifyGroup( const std::exception* ex ) {
+    group->infraMemberFired( this, ex );
+}
+
+Future< size_t > infraWhen( Node* node, bool any, const FutureBase* const* fs, size_t n );
+
+//whenAll(): resulting future becomes ready (with the number of futures) when all of them are ready
+//whenAny(): resulting future becomes ready (with the index of the future) when the first of them is ready
+//Both fail with the error of the first future which fails (right away, if one of them has failed already)
+//  the result MAY be ready (or failed) by the time whenAll()/whenAny() returns; its then() is called right away then
+//  whenAll() of an empty vector is ready with 0; whenAny() of an empty vector throws std::invalid_argument
+//A Future MAY be a member of only one whenAll()/whenAny() at a time
+template< typename T, typename... Ts >
+Future< size_t > whenAll( const Future< T >& f, const Future< Ts >& ... fs ) {
+    AASSERT4( f.infraGetPtr(), "whenAll() of an empty (moved-from?) Future" );
+    const FutureBase* list[] = { &f, &fs... };
+    return infraWhen( f.infraGetPtr()->node, false, list, 1 + sizeof...( Ts ) );
+}
+
+template< typename T >
+Future< size_t > whenAll( Node* node, const std::vector< Future< T > >& fs ) {
+    std::vector< const FutureBase* > list;
+    list.reserve( fs.size() );
+    for( auto& f : fs )
+        list.push_back( &f );
+    return infraWhen( node, false, list.data(), list.size() );
+}
+
+template< typename T, typename... Ts >
+Future< size_t > whenAny( const Future< T >& f, const Future< Ts >& ... fs ) {
+    AASSERT4( f.infraGetPtr(), "whenAny() of an empty (moved-from?) Future" );
+    const FutureBase* list[] = { &f, &fs... };
+    return infraWhen( f.infraGetPtr()->node, true, list, 1 + sizeof...( Ts ) );
+}
+
+template< typename T >
+Future< size_t > whenAny( Node* node, const std::vector< Future< T > >& fs ) {
+    std::vector< const FutureBase* > list;
+    list.reserve( fs.size() );
+    for( auto& f : fs )
+        list.push_back( &f );
+    return infraWhen( node, true, list.data(), list.size() );
+}
+
+//Future with any number of continuations
+//  all of them are called in one pass when the result arrives, and read the same (immutable) result via value();
+//  a continuation added after the future has fired (with the result, or failed) is called right away, with the same error if any
+//  the InfraFuture is reclaimed as usual, once all the continuations have run and the last SharedFuture is gone
+template< typename T >
+class SharedFuture : public Future< T > {
+  public:
+    explicit SharedFuture( Node* node_ ) : Future< T >( node_ ) {}
+    SharedFuture() {}
+    SharedFuture( const SharedFuture& ) = default;
+    SharedFuture( SharedFuture&& ) = default;
+    SharedFuture& operator=( const SharedFuture& ) = default;
+    SharedFuture& operator=( SharedFuture&& ) = default;
+
+    void then( FutureFunction ) const override;
+};
+
+template< typename T >
+void SharedFuture< T >::then( FutureFunction fn ) const {
+    auto inf = this->infraGetPtr();
+    AASSERT4( inf, "then() on an empty (moved-from?) SharedFuture" );
+    if( inf->isFired() )
+        inf->infraCallFired( fn );
+    else
+        inf->infraAddThen( std::move( fn ) );
+}
+
 template< typename T >
 class MultiFuture {
     FutureId futureId;
     Node* node;
     InfraFuture< T >* infraPtr;
 
+  protected:
+    MultiFuture( Node*, InfraFuture< T >* );
+
   public:
     explicit MultiFuture( Node* );
 //    MultiFuture();
     MultiFuture( const MultiFuture& ) = default;
-    MultiFuture( MultiFuture&& ) = default;
+    MultiFuture( MultiFuture&& );
     MultiFuture& operator=( const MultiFuture& ) = default;
+    MultiFuture& operator=( MultiFuture&& );
 
-    void onEach( const FutureFunction& f );
+    void onEach( FutureFunction f );
     FutureId infraGetId() const {
         return futureId;
     }
@@ -204,12 +470,36 @@ class MultiFuture {
 };
 
 template< typename T >
-MultiFuture< T >::MultiFuture( Node* node_ ) : node( node_ ) {
-    futureId = node->nextFutureId();
-    auto f = new InfraFuture< T >;
+MultiFuture< T >::MultiFuture( Node* node_ ) : MultiFuture( node_, infraNewFuture< T >( node_ ) ) {
+}
+
+template< typename T >
+MultiFuture< T >::MultiFuture( Node* node_, InfraFuture< T >* f ) : node( node_ ) {
     f->refCount = 0;
     f->multi = true;
-    infraPtr = static_cast<InfraFuture< T >*>( node->insertInfraFuture( futureId, f ) );
+    futureId = node->insertInfraFuture( f );
+    infraPtr = f;
+}
+
+template< typename T >
+MultiFuture< T >::MultiFuture( MultiFuture&& other ) :
+    futureId( other.futureId ), node( other.node ), infraPtr( other.infraPtr ) {
+    other.futureId = 0;
+    other.node = nullptr;
+    other.infraPtr = nullptr;
+}
+
+template< typename T >
+MultiFuture< T >& MultiFuture< T >::operator=( MultiFuture&& other ) {
+    if( this == &other )
+        return *this;
+    futureId = other.futureId;
+    node = other.node;
+    infraPtr = other.infraPtr;
+    other.futureId = 0;
+    other.node = nullptr;
+    other.infraPtr = nullptr;
+    return *this;
 }
 /*
 template<typename T>
@@ -220,16 +510,159 @@ inline MultiFuture<T>::MultiFuture() {
 }
 */
 template< typename T >
-void MultiFuture< T >::onEach( const FutureFunction& fn ) {
-    AASSERT4( infraPtr == node->findInfraFuture( futureId ) );
-    infraPtr->fn = fn;
+void MultiFuture< T >::onEach( FutureFunction fn ) {
+    AASSERT4( infraPtr, "onEach() on an empty (moved-from?) MultiFuture" );
+    AASSERT5( infraPtr == node->findInfraFuture( futureId ) );
+    infraPtr->fn = std::move( fn );
 }
 
 template< typename T >
 const T& MultiFuture< T >::value() const {
-    AASSERT4( infraPtr == node->findInfraFuture( futureId ) );
+    AASSERT4( infraPtr, "value() on an empty (moved-from?) MultiFuture" );
+    AASSERT5( infraPtr == node->findInfraFuture( futureId ) );
     return infraPtr->getResult();
 }
 
+//InfraFuture with a ring of values which have arrived but haven't been consumed yet
+//  flowControl( true ) is called when the ring reaches highWater, flowControl( false ) - when it drains down to lowWater
+//  NB: values already in flight when we pause (such as reads queued by Node in the same loop iteration) are still accepted,
+//      growing the ring past highWater; it is flowControl which bounds it, not push()
+template< typename T >
+class InfraBufferedFuture : public InfraFuture< T > {
+    std::vector< T > ring;
+    size_t head = 0;
+    size_t count = 0;
+    size_t highWater;
+    size_t lowWater;
+    bool paused = false;
+
+    void grow() {
+        std::vector< T > bigger( ring.size() * 2 );
+        for( size_t i = 0; i < count; ++i )
+            bigger[i] = std::move( ring[( head + i ) % ring.size()] );
+        ring.swap( bigger );
+        head = 0;
+    }
+
+  public:
+    InlineFunction< void( bool ) > flowControl;
+
+    InfraBufferedFuture( size_t highWater_, size_t lowWater_ ) : ring( highWater_ ), highWater( highWater_ ), lowWater( lowWater_ ) {
+        AASSERT4( highWater > 0 );
+        AASSERT4( lowWater < highWater );
+    }
+
+    size_t size() const {
+        return count;
+    }
+    const T& front() const {
+        AASSERT4( count > 0 );
+        return ring[head];
+    }
+    void push( T&& v ) {
+        if( count == ring.size() )
+            grow();
+        ring[( head + count ) % ring.size()] = std::move( v );
+        ++count;
+        if( !paused && count >= highWater ) {
+            paused = true;
+            if( flowControl )
+                flowControl( true );
+        }
+    }
+    T pop() {
+        AASSERT4( count > 0 );
+        T ret = std::move( ring[head] );
+        head = ( head + 1 ) % ring.size();
+        --count;
+        if( paused && count <= lowWater ) {
+            paused = false;
+            if( flowControl )
+                flowControl( false );
+        }
+        return ret;
+    }
+
+    void debugDump() const override {
+        INFRATRACE4( "    {} refcnt {} {} buffered {}/{}", ( void* )this, this->refCount, this->multi, count, ring.size() );
+    }
+    size_t infraSize() const override {
+        return sizeof( *this );
+    }
+};
+
+//MultiFuture which queues up to highWater values instead of overwriting the only one
+//  onEach() is still called as each value arrives, but values are consumed with pop() - right away or later;
+//  the producer (such as TcpSocket::read()) is paused while highWater (or more, see InfraBufferedFuture) values are pending,
+//  and is resumed when consumer drains the queue down to lowWater
+//  each BufferedMultiFuture holds a reference to the queue, so values still pending when the source is closed
+//  MAY be consumed later too; the queue is reclaimed once the source is closed and the last BufferedMultiFuture is gone
+template< typename T >
+class BufferedMultiFuture : public MultiFuture< T > {
+    InfraBufferedFuture< T >* bufPtr;
+
+  public:
+    BufferedMultiFuture( Node* node_, size_t highWater, size_t lowWater ) :
+        BufferedMultiFuture( node_, infraNewFutureOf< InfraBufferedFuture< T > >( node_, highWater, lowWater ) ) {}
+    BufferedMultiFuture( const BufferedMultiFuture& other ) : MultiFuture< T >( other ), bufPtr( other.bufPtr ) {
+        if( bufPtr )
+            bufPtr->refCount++;
+    }
+    BufferedMultiFuture( BufferedMultiFuture&& other ) : MultiFuture< T >( std::move( other ) ), bufPtr( other.bufPtr ) {
+        other.bufPtr = nullptr;
+    }
+    BufferedMultiFuture& operator=( const BufferedMultiFuture& other ) {
+        if( this == &other )
+            return *this;
+        if( other.bufPtr )
+            other.bufPtr->refCount++;
+        if( bufPtr )
+            bufPtr->releaseRef();
+        MultiFuture< T >::operator=( other );
+        bufPtr = other.bufPtr;
+        return *this;
+    }
+    BufferedMultiFuture& operator=( BufferedMultiFuture&& other ) {
+        if( this == &other )
+            return *this;
+        if( bufPtr )
+            bufPtr->releaseRef();
+        bufPtr = other.bufPtr;
+        other.bufPtr = nullptr;
+        MultiFuture< T >::operator=( std::move( other ) );
+        return *this;
+    }
+    ~BufferedMultiFuture() {
+        if( bufPtr )
+            bufPtr->releaseRef();
+    }
+
+    const T& value() const = delete;//use front()/pop() instead
+
+    size_t size() const {
+        AASSERT4( bufPtr, "size() on an empty (moved-from?) BufferedMultiFuture" );
+        return bufPtr->size();
+    }
+    bool empty() const {
+        return size() == 0;
+    }
+    const T& front() const {
+        AASSERT4( bufPtr, "front() on an empty (moved-from?) BufferedMultiFuture" );
+        return bufPtr->front();
+    }
+    T pop() const {
+        AASSERT4( bufPtr, "pop() on an empty (moved-from?) BufferedMultiFuture" );
+        return bufPtr->pop();
+    }
+    void infraSetFlowControl( InlineFunction< void( bool ) > fn ) const {
+        bufPtr->flowControl = std::move( fn );
+    }
+
+  private:
+    BufferedMultiFuture( Node* node_, InfraBufferedFuture< T >* f ) : MultiFuture< T >( node_, f ), bufPtr( f ) {
+        bufPtr->refCount++;
+    }
+};
+
 }
 #endif
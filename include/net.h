@@ -28,7 +28,12 @@ class TcpSocket {
 
     void close() const;
     MultiFuture< Buffer > read() const;
+    //reading is paused while highWater buffers are pending in returned future
+    BufferedMultiFuture< Buffer > read( size_t highWater, size_t lowWater ) const;
     void write( const void* buff, size_t sz ) const;
+    //Large payloads are not copied, see TcpZeroSocket::write()
+    void write( std::string&& payload ) const;
+    void write( const NetworkBuffer& buff ) const;
 };
 
 class TcpServer {
@@ -41,6 +46,10 @@ class TcpServer {
     explicit TcpServer( Node* node_ ) : node( node_ ), zero( node_->parentLoop ) {}
 
     MultiFuture< TcpSocket > listen( int port );
+    int port() const {
+        return zero.port();
+    }
+    void close();
 };
 
 namespace net {
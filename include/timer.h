@@ -16,6 +16,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #define TIMER_H
 
 #include "future.h"
+#include "zerotimer.h"
 
 namespace autom {
 
@@ -24,6 +25,8 @@ class Timer {
 
 Future< Timer > startTimeout( Node* node, unsigned secDelay );
 void startTimeout( const Future< Timer >&, Node* node, unsigned secDelay );
+//NB: the timer MUST be released with cancelTimeout() (see zerotimer.h), whether the future is ready by then or not
+ZeroTimeout startTimeoutMs( const Future< Timer >&, Node* node, unsigned msDelay );
 MultiFuture< Timer > setInterval( Node* node, unsigned secRepeat );
 
 }
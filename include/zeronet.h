@@ -15,7 +15,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #ifndef ZERONET_H
 #define ZERONET_H
 
-#include <functional>
+#include <string>
+
+#include "afunction.h"
 
 namespace autom {
 
@@ -30,11 +32,19 @@ class TcpZeroSocket {
     Handle h;
 
     void read() const;
+    void pauseRead() const;
+    void resumeRead() const;
+    //buff is copied, so it MAY be reused right away; writes within one loop iteration go out together
     void write( const void* buff, size_t sz ) const;
+    //Same, but a payload of a write chunk (16K) or more is not copied: it is kept as it is until written
+    void write( std::string&& payload ) const;
+    void write( const NetworkBuffer& buff ) const;
     void close() const;
 
-    void on( int eventId, std::function< void( const NetworkBuffer* ) > fn ) const;
-    void on( int eventId, std::function< void( void ) > fn ) const;
+    void on( int eventId, InlineFunction< void( const NetworkBuffer* ) > fn ) const;
+    //ID_CLOSED, with status: 0 if the peer has closed the connection, libuv error otherwise
+    void on( int eventId, InlineFunction< void( int ) > fn ) const;
+    void on( int eventId, InlineFunction< void( void ) > fn ) const;
 };
 
 class TcpZeroServer {
@@ -45,15 +55,29 @@ class TcpZeroServer {
     TcpZeroServer( LoopContainer* );
 
     bool listen( int port );
+    //Port it listens on (such as the one picked by the OS for listen( 0 )), 0 if it doesn't
+    int port() const;
+    void close();
+
+    void on( int eventId, InlineFunction< void( TcpZeroSocket ) > fn );
+    void on( int eventId, InlineFunction< void( void ) > fn );
+};
 
-    void on( int eventId, std::function< void( TcpZeroSocket ) > fn );
-    void on( int eventId, std::function< void( void ) > fn );
+//What TcpZeroSocket::write()'s of the current thread have come to (see StreamInteface::flush())
+struct ZeroWriteStats {
+    size_t flushes = 0;//batches, one per socket per loop iteration
+    size_t tryWritten = 0;//batches written by uv_try_write() right away
+    size_t partial = 0;//batches uv_try_write() has written a part of
+    size_t uvWrites = 0;
+    size_t bytes = 0;
+    size_t referenced = 0;//bytes written right from the payloads handed over, without copying
 };
 
 namespace net {
 
 TcpZeroServer createServer( LoopContainer* loop );
 TcpZeroSocket connect( LoopContainer* loop, const char* addr, int port );
+const ZeroWriteStats& writeStats();
 
 }
 
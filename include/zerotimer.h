@@ -14,14 +14,24 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #ifndef ZEROTIMER_H
 #define ZEROTIMER_H
 
-#include <functional>
+#include "afunction.h"
 
 namespace autom {
 
 class LoopContainer;
 
-void setInterval( LoopContainer*, std::function< void( void ) >, unsigned secRepeat );
-void startTimeout( LoopContainer*, std::function< void( void ) >, unsigned secDelay );
+void setInterval( LoopContainer*, InlineFunction< void( void ) >, unsigned secRepeat );
+void startTimeout( LoopContainer*, InlineFunction< void( void ) >, unsigned secDelay );
+void startTimeoutMs( LoopContainer*, InlineFunction< void( void ) >, unsigned msDelay );
+
+//Timeout which its owner releases with cancelTimeout(), whether it has fired by then or not
+//  NB: until released, its uv timer stays open (and keeps the loop alive); once released, fn is never called
+struct ZeroTimeout {
+    void* timer = nullptr;
+};
+
+ZeroTimeout startCancellableTimeoutMs( LoopContainer*, InlineFunction< void( void ) >, unsigned msDelay );
+void cancelTimeout( ZeroTimeout& timeout );
 
 }
 
@@ -22,100 +22,150 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 using namespace autom;
 
 void Node::infraProcessTimer( const NodeQTimer& item ) {
-    auto it = futureMap.find( item.id );
-    if( it != futureMap.end() ) {
-        it->second->setDataReady();
-        it->second->fn( nullptr );
-        it->second->cleanup();
-        futureCleanup();
+    if( auto f = futureMap.find( item.id ) ) {
+        f->setDataReady();
+        f->infraFire( nullptr );
+        f->cleanup();
     }
 }
 
 void Node::infraProcessTcpAccept( const NodeQAccept& item ) {
-    auto it = futureMap.find( item.id );
-    if( it != futureMap.end() ) {
-        auto f = static_cast<InfraFuture< TcpSocket >*>( it->second.get() );
+    if( auto inf = futureMap.find( item.id ) ) {
+        auto f = static_cast<InfraFuture< TcpSocket >*>( inf );
         f->infraGetData().node = this;
-        f->infraGetData().zero = item.sock->zero;
+        f->infraGetData().zero = item.zero;
         f->setDataReady();
-        it->second->fn( nullptr );
-        it->second->cleanup();
-        futureCleanup();
+        f->infraFire( nullptr );
+        f->cleanup();
     }
 }
 
 void Node::infraProcessTcpRead( const NodeQBuffer& item ) {
-    auto it = futureMap.find( item.id );
-    if( it != futureMap.end() ) {
-        auto f = static_cast<InfraFuture< Buffer >*>( it->second.get() );
-        std::exception* ex = f->infraGetData().fromNetwork( item.b );
+    if( auto inf = futureMap.find( item.id ) ) {
+        auto f = static_cast<InfraFuture< Buffer >*>( inf );
+        const ErrorStatus* ex = f->infraGetData().fromNetwork( item.b );
+        f->setDataReady();
+        f->infraFire( ex );
+        f->cleanup();
+    }
+}
+
+void Node::infraProcessTcpReadBuffered( const NodeQBuffer& item ) {
+    if( auto inf = futureMap.find( item.id ) ) {
+        auto f = static_cast<InfraBufferedFuture< Buffer >*>( inf );
+        Buffer b;
+        const ErrorStatus* ex = b.fromNetwork( item.b );
+        if( !ex )
+            f->push( std::move( b ) );
         f->setDataReady();
-        it->second->fn( ex );
-        delete ex;
-        it->second->cleanup();
-        futureCleanup();
+        f->infraFire( ex );
+        f->cleanup();
     }
 }
 
 void Node::infraProcessTcpClosed( const NodeQClosed& item ) {
-    auto it = futureMap.find( item.id );
-    if( it != futureMap.end() ) {
-        std::exception ex;
-        it->second->fn( &ex );
-        it->second->cleanupMulti();
-        futureCleanup();
+    if( auto f = futureMap.find( item.id ) ) {
+        f->infraFire( &ErrorStatus::get( item.code ) );
+        f->cleanupMulti();
     }
 }
 
 void Node::infraProcessTcpConnect( const NodeQConnect& item ) {
-    auto it = futureMap.find( item.id );
-    if( it != futureMap.end() ) {
-        auto f = static_cast<InfraFuture< TcpSocket >*>( it->second.get() );
+    if( auto inf = futureMap.find( item.id ) ) {
+        auto f = static_cast<InfraFuture< TcpSocket >*>( inf );
         f->infraGetData().node = this;
-        f->infraGetData().zero = item.sock->zero;
+        f->infraGetData().zero = item.zero;
         f->setDataReady();
-        it->second->fn( nullptr );
-        it->second->cleanup();
-        futureCleanup();
+        f->infraFire( nullptr );
+        f->cleanup();
     }
 }
 
-InfraFutureBase* Node::insertInfraFuture( FutureId id, InfraFutureBase* inf ) {
-    auto p = futureMap.insert( FutureMap::value_type( id, std::unique_ptr<InfraFutureBase>( inf ) ) );
-    AASSERT4( p.second, "Duplicated FutureId" );
-    return p.first->second.get();
+Node::~Node() {
+    if( eventsScheduled && parentLoop )
+        parentLoop->infraUnschedule( this );
 }
 
-InfraFutureBase* Node::findInfraFuture( FutureId id ) {
-    auto it = futureMap.find( id );
-    if( it != futureMap.end() )
-        return it->second.get();
-    return nullptr;
+void Node::infraPost( NodeQEvent&& ev ) {
+    eventQueue.push( std::move( ev ) );
+    if( !eventsScheduled ) {
+        AASSERT4( parentLoop );
+        eventsScheduled = true;
+        parentLoop->infraSchedule( this );
+    }
 }
 
-void Node::futureCleanup() {
-    for( auto it = futureMap.begin(); it != futureMap.end(); ) {
-        AASSERT4( it->second->refCount >= 0 );
-        if( ( !it->second->multi ) && ( it->second->refCount <= 0 ) ) {
-            it = futureMap.erase( it );
-        } else {
-            ++it;
+void Node::infraRunLoopTask() {
+    eventsScheduled = false;
+    infraProcessEvents();
+}
+
+void Node::infraProcessEvents() {
+    while( !eventQueue.empty() ) {
+        NodeQEvent ev = eventQueue.pop();
+        switch( ev.type ) {
+            case NODEQ::TIMER:
+                infraProcessTimer( ev.timer );
+                break;
+            case NODEQ::ACCEPT:
+                infraProcessTcpAccept( ev.accept );
+                break;
+            case NODEQ::READ:
+                infraProcessTcpRead( ev.buffer );
+                break;
+            case NODEQ::READ_BUFFERED:
+                infraProcessTcpReadBuffered( ev.buffer );
+                break;
+            case NODEQ::CLOSED:
+                infraProcessTcpClosed( ev.closed );
+                break;
+            case NODEQ::CONNECT:
+                infraProcessTcpConnect( ev.connect );
+                break;
+            default:
+                AASSERT4( false, "Unknown NodeQEvent type {}", static_cast<int>( ev.type ) );
         }
     }
+    futureCleanup();
+}
+
+FutureId Node::insertInfraFuture( InfraFutureBase* inf ) {
+    inf->node = this;
+    inf->id = futureMap.insert( inf );
+    return inf->id;
+}
+
+void Node::futureCleanup() {
+    //NB: destroying an InfraFuture MAY release more of them (via Futures captured in its fn),
+    //    so releasedFutures MAY grow while we're here
+    while( !releasedFutures.empty() ) {
+        auto f = releasedFutures.back();
+        releasedFutures.pop_back();
+        f->releaseQueued = false;
+        AASSERT4( f->refCount >= 0 );
+        if( ( !f->multi ) && ( f->refCount <= 0 ) )
+            futureMap.erase( f->id );
+    }
 }
 
 bool Node::isEmpty() const {
-    for( auto& it : futureMap ) {
-        if( ( !it.second->multi ) && it.second->refCount )
+    for( size_t i = 0; i < futureMap.slotCount(); ++i ) {
+        auto f = futureMap.atSlot( i );
+        if( f && ( !f->multi ) && f->refCount )
             return false;
     }
     return true;
 }
 
 void Node::debugDump() const {
-    INFRATRACE4( "futures {}", futureMap.size() );
-    for( auto& it : futureMap ) {
-        INFRATRACE4( "  #{}", it.first );
-        it.second->debugDump();
+    const auto& st = futurePool.getStats();
+    INFRATRACE4( "futures {} pool: hits {} misses {} in use {} slabs {}", futureMap.size(), st.hits, st.misses, st.inUse, st.slabs );
+    const auto& fr = framePool.getStats();
+    INFRATRACE4( "coroutine frames pool: hits {} misses {} in use {} slabs {}", fr.hits, fr.misses, fr.inUse, fr.slabs );
+    for( size_t i = 0; i < futureMap.slotCount(); ++i ) {
+        if( auto f = futureMap.atSlot( i ) ) {
+            INFRATRACE4( "  #{}", futureMap.idAtSlot( i ) );
+            f->debugDump();
+        }
     }
 }
@@ -16,130 +16,341 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 namespace autom {
 
-CTryStep CTryStep::ccatch( ExHandlerFunction handler ) {
-    CCode::setExhandlerChain( step, handler );
-    return *this;
-}
+//Each step is preceded by the arena it comes from, so that release() finds it
+//  chunks are linked (first one is the arena's), and are all kept when the arena is reused
+struct AStepChunk {
+    AStepChunk* next;
+    size_t size;//of the data following the chunk
+};
 
-struct IifFunctor {
-    const Future<bool> b;
-    AStep* head;
-    AStep* c1;
-    AStep* e1;
+struct AStepArenaImpl {
+    static const size_t HEADER = alignof( std::max_align_t );
+    static const size_t CHUNK = 4096;
+    static const int MAX_FREE = 64;//released arenas kept per thread
 
-    explicit IifFunctor( const Future<bool>& b_, AStep* c_ ) : b( b_ ), c1( c_ ) {
-        e1 = c1->endOfChain();
-        head = new AStep;
-        head->debugOpCode = AStep::COND;
-        head->fn = *this;
-    };
-    void operator() ( const std::exception * ex ) {
-        AASSERT4( head->debugOpCode == AStep::COND );
-        if( b.value() ) {
-            // insert active branch in execution chain
-            auto tmp = head->next;
-            head->next = c1;
-            e1->next = tmp;
-            head->debugDumpChain( "iif new exec chain:" );
-        } else {
-            CCode::deleteChain( c1, nullptr );
+    AStepChunk* chunks = nullptr;
+    AStepChunk* current = nullptr;
+    char* cur = nullptr;
+    char* end = nullptr;
+    size_t live = 0;
+    bool sealed = false;
+    AStepArenaImpl* nextFree = nullptr;
+
+    ~AStepArenaImpl() {
+        while( chunks ) {
+            AStepChunk* c = chunks;
+            chunks = c->next;
+            ::operator delete( c );
         }
     }
+    void reset() {
+        current = chunks;
+        cur = current ? reinterpret_cast< char* >( current + 1 ) : nullptr;
+        end = current ? cur + current->size : nullptr;
+        live = 0;
+        sealed = false;
+    }
 };
+static_assert( sizeof( AStepChunk ) % alignof( std::max_align_t ) == 0, "AStepChunk MUST keep the steps aligned" );
 
-struct EelseFunctor {
-    const Future<bool> b;
-    AStep* head;
-    AStep* c1;
-    AStep* c2;
-    AStep* e1;
-    AStep* e2;
+struct AStepArenas {
+    AStepArenaImpl* building = nullptr;
+    AStepArenaImpl* free = nullptr;
+    int freeCount = 0;
+    AStepArena::Stats stats;
 
-    explicit EelseFunctor( const Future<bool>& b_ ) : b( b_ ) {}
-    void operator() ( const std::exception* ) {
-        AASSERT4( head->debugOpCode == AStep::COND );
-        // insert active branch into exec list
-        AStep* active, *passive, *end;
-        if( b.value() ) {
-            active = c1;
-            passive = c2;
-            end = e1;
+    ~AStepArenas() {
+        while( free ) {
+            AStepArenaImpl* a = free;
+            free = a->nextFree;
+            delete a;
+        }
+        //NB: arena being built (if any) belongs to steps which have never made it into a CCode, and leaks with them
+    }
+};
+static thread_local AStepArenas arenas;
+
+#ifdef ACCODE_HEAP_STEPS
+
+void* AStepArena::alloc( size_t sz ) {
+    ++arenas.stats.steps;
+    ++arenas.stats.heapAllocs;
+    arenas.stats.heapBytes += sz;
+    return ::operator new( sz );
+}
+
+void AStepArena::release( void* p ) {
+    ::operator delete( p );
+}
+
+void AStepArena::seal() {
+    ++arenas.stats.programs;
+}
+
+#else
+
+void* AStepArena::alloc( size_t sz ) {
+    AStepArenaImpl* a = arenas.building;
+    if( !a ) {
+        if( arenas.free ) {
+            a = arenas.free;
+            arenas.free = a->nextFree;
+            --arenas.freeCount;
+            ++arenas.stats.reused;
         } else {
-            active = c2;
-            passive = c1;
-            end = e2;
+            a = new AStepArenaImpl;
+            ++arenas.stats.heapAllocs;
+            arenas.stats.heapBytes += sizeof( AStepArenaImpl );
         }
-        // insert active branch in execution chain
-        auto tmp = head->next;
-        head->next = active;
-        end->next = tmp;
-        CCode::deleteChain( passive, nullptr );
+        a->reset();
+        arenas.building = a;
+    }
+    const size_t need = AStepArenaImpl::HEADER + ( sz + AStepArenaImpl::HEADER - 1 ) / AStepArenaImpl::HEADER * AStepArenaImpl::HEADER;
+    while( static_cast< size_t >( a->end - a->cur ) < need ) {
+        AStepChunk* next = a->current ? a->current->next : a->chunks;
+        if( !next || next->size < need ) {
+            //NB: a chunk too small for the step stays where it is, and is just skipped this time
+            const size_t size = need > AStepArenaImpl::CHUNK ? need : AStepArenaImpl::CHUNK;
+            AStepChunk* c = static_cast< AStepChunk* >( ::operator new( sizeof( AStepChunk ) + size ) );
+            ++arenas.stats.heapAllocs;
+            arenas.stats.heapBytes += sizeof( AStepChunk ) + size;
+            c->size = size;
+            c->next = next;
+            if( a->current )
+                a->current->next = c;
+            else
+                a->chunks = c;
+            next = c;
+        }
+        a->current = next;
+        a->cur = reinterpret_cast< char* >( next + 1 );
+        a->end = a->cur + next->size;
+    }
+    char* p = a->cur;
+    a->cur += need;
+    *reinterpret_cast< AStepArenaImpl** >( p ) = a;
+    ++a->live;
+    ++arenas.stats.steps;
+    return p + AStepArenaImpl::HEADER;
+}
+
+void AStepArena::release( void* p ) {
+    AStepArenaImpl* a = *reinterpret_cast< AStepArenaImpl** >( static_cast< char* >( p ) - AStepArenaImpl::HEADER );
+    AASSERT4( a->live > 0 );
+    if( --a->live || !a->sealed )
+        return;
+    if( arenas.freeCount < AStepArenaImpl::MAX_FREE ) {
+        a->nextFree = arenas.free;
+        arenas.free = a;
+        ++arenas.freeCount;
+    } else {
+        delete a;
+    }
+}
+
+void AStepArena::seal() {
+    AStepArenaImpl* a = arenas.building;
+    AASSERT4( a && a->live, "CCode without steps" );
+    a->sealed = true;
+    arenas.building = nullptr;
+    ++arenas.stats.programs;
+}
+
+#endif
+
+const AStepArena::Stats& AStepArena::stats() {
+    return arenas.stats;
+}
+
+CTryStep CTryStep::infraCcatchImpl( ExHandlerFunction handler ) {
+    CCode::setExhandlerChain( step, handler );
+    return *this;
+}
+
+//Worklist of branches not walked yet (see CCode::walkChain()); spills to the heap only for deeply nested programs
+class AStepStack {
+    static const size_t INPLACE = 16;
+    AStep* inplace[INPLACE];
+    std::vector< AStep* > spilled;
+    size_t n = 0;
+
+  public:
+    bool empty() const {
+        return n == 0;
+    }
+    void push( AStep* s ) {
+        if( n < INPLACE )
+            inplace[n] = s;
+        else
+            spilled.push_back( s );
+        ++n;
+    }
+    AStep* pop() {
+        AASSERT4( n > 0 );
+        --n;
+        if( n < INPLACE )
+            return inplace[n];
+        AStep* s = spilled.back();
+        spilled.pop_back();
+        return s;
     }
 };
 
+//Calls visit() for each step of chain s..e (or s..end of chain if e is not there), and of all the branches within it
+//  iterative; visit() MAY delete the step, so everything we need from it is read beforehand
+template< typename Visit >
+void CCode::walkChain( AStep* s, const AStep* e, Visit&& visit ) {
+    AStepStack pending;
+    for( ;; ) {
+        while( s ) {
+            AStep* next = s == e ? nullptr : s->next;
+            if( s->hasBranches() ) {
+                if( s->branches.c2 )
+                    pending.push( s->branches.c2 );
+                pending.push( s->branches.c1 );
+            } else {
+                AASSERT4( ( AStep::EXEC == s->debugOpCode ) || ( AStep::WAIT == s->debugOpCode ) );
+            }
+            visit( s );
+            s = next;
+        }
+        if( pending.empty() )
+            return;
+        s = pending.pop();
+    }
+}
+
 void CIfStep::infraEelseImpl( AStep* c2 ) {
     AASSERT4( this );
     AASSERT4( step );
     AASSERT4( !step->next );
     AASSERT4( step->debugOpCode == AStep::COND );
+    AASSERT4( !step->branches.c2 );
     AASSERT4( c2 );
 
-    auto iif = step->fn.target< IifFunctor >();
-
-    iif->c1->debugDumpChain( "====IFELSE FIRST BRANCH" );
+    step->branches.c1->debugDumpChain( "====IFELSE FIRST BRANCH" );
     c2->debugDumpChain( "====IFELSE SCOND BRANCH" );
 
-    EelseFunctor func( iif->b );
-    func.c1 = iif->c1;
-    func.c2 = c2;
-    func.head = step;
-    func.e1 = func.c1->endOfChain();
-    func.e2 = c2->endOfChain();
-
-    step->fn = func;
+    step->branches.c2 = c2;
+    step->branches.e2 = c2->endOfChain();
+    step->branches.e2->up = step;
 }
 
 CIfStep CCode::infraIifImpl( const Future<bool>& b, AStep* c ) {
     AASSERT4( c );
     c->debugDumpChain( "iifImpl" );
-    return CIfStep( IifFunctor( b, c ).head );
-}
-
-struct WhileFunctor {
-    const Future<bool> b;
-    AStep* head;
-    AStep* c1;
-    AStep* e1;
-
-    explicit WhileFunctor( const Future<bool>& b_, AStep* c_ ) : b( b_ ), c1( c_ ) {
-        AASSERT4( c1 );
-        e1 = c1->endOfChain();
-        head = new AStep;
-        head->debugOpCode = AStep::LOOP;
-        e1->nextExec = head;
-        head->fn = *this;
-    };
-    void operator() ( const std::exception * ex ) {
-        AASSERT4( head->debugOpCode == AStep::LOOP );
-        if( !e1->next ) {
-            AASSERT4( !e1->next );
-            e1->next = head->next;
-            head->next = c1;
-        }
-        if( b.value() ) {
-            CCode::addRefChain( c1, e1 );
-            head->refCount++;
-        } else {
-            head->nextExec = e1->next;
-            CCode::deleteChain( c1, e1 );
-        }
+    return CIfStep( new AStep( AStep::COND, b, c ) );
+}
+
+//Next step to execute after s: s->next, or (at the end of a branch) the step after the COND, or (at the end of a loop body) the LOOP itself
+//  at the end of PAR branch, it is the step after PAR if it was the last branch running, and nullptr otherwise
+AStep* CCode::successor( AStep* s ) {
+    while( !s->next ) {
+        AStep* h = s->up;
+        if( !h || AStep::LOOP == h->debugOpCode )
+            return h;
+        if( AStep::PAR == h->debugOpCode )
+            return joinBranch( h, AStep::PAR_OK );
+        s = h;
     }
-};
+    return s->next;
+}
+
+CParStep CCode::infraParImpl( AStep* c ) {
+    AASSERT4( c );
+    c->debugDumpChain( "parallelImpl" );
+    AStep* head = new AStep( AStep::PAR, c );
+    setOwnedChain( c );
+    return CParStep( head );
+}
 
+//NB: third and further branches go to nested PAR's, so that each PAR has exactly two of them
+void CParStep::infraAandImpl( AStep* branch ) {
+    AASSERT4( step->debugOpCode == AStep::PAR );
+    AASSERT4( branch );
+    auto& br = step->branches;
+    if( br.c2 ) {
+        AStep* nested = new AStep( AStep::PAR, br.c2 );
+        nested->owned = true;
+        br.c2 = br.e2 = nested;
+    }
+    AStep* target = br.c2 ? br.c2 : step;
+    auto& tbr = target->branches;
+    tbr.c2 = branch;
+    tbr.e2 = branch->endOfChain();
+    tbr.e2->up = target;
+    CCode::setOwnedChain( branch );
+    if( target != step )
+        target->up = step;
+}
+
+//One of the branches of PAR is over; returns the step to execute next
+//  when all of them are over: the step after PAR, or (if any of them has failed) whatever unwind() says
+AStep* CCode::joinBranch( AStep* head, char how ) {
+    AASSERT4( head->debugOpCode == AStep::PAR );
+    auto& br = head->branches;
+    AASSERT4( br.pending > 0 );
+    if( how > br.failure )
+        br.failure = how;
+    if( --br.pending > 0 )
+        return nullptr;
+    if( AStep::PAR_OK != br.failure )
+        return unwind( head, AStep::PAR_CAUGHT == br.failure );
+
+    //NB: owned head MAY be gone by the time successor() returns (if it joins the enclosing PAR)
+    bool owned = head->owned;
+    AStep* next = successor( head );
+    if( !owned )
+        dropStep( head );
+    return next;
+}
+
+//Returns the step to execute next
+//  within a loop body, COND is executed by cursor, and both branches are kept for the next iteration
+//  otherwise, the active branch is spliced into the execution chain and the passive one is deleted
+AStep* CCode::execCond( AStep* head ) {
+    AASSERT4( head->debugOpCode == AStep::COND );
+    auto& br = head->branches;
+    AStep* active, *activeEnd, *passive;
+    if( br.b->getResult() ) {
+        active = br.c1;
+        activeEnd = br.e1;
+        passive = br.c2;
+    } else {
+        active = br.c2;
+        activeEnd = br.e2;
+        passive = br.c1;
+    }
+    if( head->owned )
+        return active ? active : successor( head );
+
+    if( active ) {
+        // insert active branch in execution chain
+        activeEnd->next = head->next;
+        activeEnd->up = head->up;
+        head->next = active;
+        head->debugDumpChain( "iif new exec chain:" );
+    }
+    if( passive )
+        deleteChain( passive, nullptr );
+    return successor( head );
+}
+
+//NB: loop body is marked as owned here, once; iterations then cost nothing beyond executing the body
 CStep CCode::infraWhileImpl( const Future<bool>& b, AStep* c ) {
     AASSERT4( c );
     c->debugDumpChain( "wwhileImpl" );
-    return CStep( WhileFunctor( b, c ).head );
+    AStep* head = new AStep( AStep::LOOP, b, c );
+    setOwnedChain( c );
+    return CStep( head );
+}
+
+//Loop is over; the body goes together with the LOOP step, unless it belongs to an outer loop (and will be executed again)
+AStep* CCode::exitLoop( AStep* head ) {
+    AASSERT4( head->debugOpCode == AStep::LOOP );
+    if( !head->owned )
+        deleteChain( head->branches.c1, nullptr );
+    return successor( head );
 }
 
 struct WaitFunctor {
@@ -149,18 +360,22 @@ struct WaitFunctor {
     void operator() ( const std::exception* ex ) {
         AASSERT4( a->debugOpCode == AStep::WAIT );
         AASSERT4( a->infraPtr );
+        //NB: WAIT which hasn't been reached yet is failed by runChain() once it is (see isFailed() there); until then,
+        //    the steps before it are still running, so nothing MAY be unwound here
+        if( !a->isStepReady() )
+            return;
+        CCode::stopWaiting( a );
         if( ex ) {
             if( a->exHandler ) {
                 a->exHandler( *ex );
-                a = CCode::deleteExChain( a );
-                CCode::exec( a );
+                CCode::resume( CCode::unwind( a, true ) );
             } else {
-                CCode::deleteChain( a, nullptr );
+                CCode::unwind( a, false );
             }
-        } else if( a->isStepReady() ) {
+        } else {
             AASSERT4( a->infraPtr->isDataReady() );
             a->debugDump( "callback" );
-            CCode::exec( a );
+            CCode::resume( a );
         }
     }
 };
@@ -170,171 +385,362 @@ CStep CCode::waitFor( const FutureBase& future ) {
     a->debugOpCode = AStep::WAIT;
     a->infraPtr = future.infraGetPtr();
     a->infraPtr->refCount++;
-    future.then( WaitFunctor( a ) );
+    //NB: future which has fired already (such as a whenAll() which is over) won't fire again; runChain() takes it as it is
+    if( !a->infraPtr->isFired() )
+        future.then( WaitFunctor( a ) );
     a->debugDumpChain( "waitFor" );
 
     return CStep( a );
 }
 
-void CCode::setExhandlerChain( AStep* s, ExHandlerFunction handler ) {
-    static int globalId = 0; // TODO: implement
+CStep CCode::waitFor( const FutureBase& future, unsigned msTimeout ) {
+    AASSERT4( msTimeout > 0 );
+    CStep s = waitFor( future );
+    s.step->waiting.deadlineMs = msTimeout;
+    return s;
+}
+
+struct DeadlineFunctor {
+    AStep* a;
+
+    explicit DeadlineFunctor( AStep* a_ ) : a( a_ ) {}
+    void operator() ( const std::exception* ) {
+        CCode::expire( a );
+    }
+};
+
+//s has been reached before its future is ready: it goes to its token's list, and its deadline (if any) is armed
+//  NB: deadline is a Future< Timer > of the same Node; its uv timer is closed by stopWaiting(), whichever comes first
+//      (if the timer has fired, but Node hasn't processed it yet, it fires into nothing, see Node::infraProcessTimer())
+void CCode::startWaiting( AStep* s ) {
+    auto& w = s->waiting;
+#ifdef ACCODE_PROFILING
+    if( s->site )
+        w.since = infraProfileNow();
+#endif
+    if( s->token ) {
+        AASSERT4( !w.listed );
+        w.listed = true;
+        w.prev = nullptr;
+        w.next = s->token->waiting;
+        if( w.next )
+            w.next->waiting.prev = s;
+        s->token->waiting = s;
+    }
+    if( w.deadlineMs ) {
+        AASSERT4( !w.deadline );
+        Node* node = s->infraPtr->node;
+        AASSERT4( node, "AWAIT_FOR: future without Node" );
+        Future< Timer > deadline( node );
+        w.timer = startTimeoutMs( deadline, node, w.deadlineMs );
+        deadline.then( DeadlineFunctor( s ) );
+        w.deadline = deadline.infraGetPtr();
+        w.deadline->refCount++;
+    }
+}
+
+//s is not waiting anymore (or has never been): leaves its token's list, and disarms its deadline
+void CCode::stopWaiting( AStep* s ) {
+    auto& w = s->waiting;
+#ifdef ACCODE_PROFILING
+    if( w.since ) {
+        s->site->wait.add( infraProfileNow() - w.since );
+        w.since = 0;
+    }
+#endif
+    if( w.listed ) {
+        if( w.prev )
+            w.prev->waiting.next = w.next;
+        else
+            s->token->waiting = w.next;
+        if( w.next )
+            w.next->waiting.prev = w.prev;
+        w.prev = w.next = nullptr;
+        w.listed = false;
+    }
+    if( w.deadline ) {
+        cancelTimeout( w.timer );
+        //NB: fired deadline is cleaned up by Node, once DeadlineFunctor is over
+        if( !w.deadline->isDataReady() )
+            w.deadline->cleanup();
+        w.deadline->releaseRef();
+        w.deadline = nullptr;
+    }
+}
+
+//Deadline of s is over before its future is ready: s fails as if the future has failed with ErrorStatus::TIMEOUT
+void CCode::expire( AStep* s ) {
+    AASSERT4( s->debugOpCode == AStep::WAIT );
+    stopWaiting( s );
+    s->infraPtr->cleanup();//NB: WaitFunctor MUST NOT come after us
+    const ErrorStatus& x = ErrorStatus::get( ErrorStatus::TIMEOUT );
+    if( s->exHandler ) {
+        s->exHandler( x );
+        resume( unwind( s, true ) );
+    } else {
+        unwind( s, false );
+    }
+}
+
+//NB: MAY be called from a step of a program being cancelled; the steps of it which are not waiting are dropped by runChain(),
+//    once it sees the token cancelled
+void CancelToken::cancel() {
+    cancelled = true;
+    while( waiting ) {
+        AStep* s = waiting;
+        CCode::stopWaiting( s );
+        CCode::unwind( s, false );
+    }
+}
+
+void CCode::setExhandlerChain( AStep* s, const ExHandlerFunction& handler ) {
+    static thread_local int globalId = 0;//NB: only tells TTRY's apart (of the programs built by the thread), see unwind()
     int id = ++globalId;
-    while( s ) {
+    walkChain( s, nullptr, [ & ]( AStep * s ) {
+        ++s->exDepth;//NB: steps of nested TTRY's too, as their handlers are set already
         if( !s->exHandler ) {
-            s->exHandler = handler;
+            s->exHandler = handler.clone();
             s->exId = id;
         }
-        if( !s->infraPtr ) {
-            AASSERT4( ( AStep::EXEC == s->debugOpCode ) || ( AStep::COND == s->debugOpCode ) || ( AStep::LOOP == s->debugOpCode ) );
-            if( auto f = s->fn.target< IifFunctor >() ) {
-                setExhandlerChain( f->c1, handler );
-            } else if( auto f = s->fn.target< EelseFunctor >() ) {
-                setExhandlerChain( f->c1, handler );
-                setExhandlerChain( f->c2, handler );
-            } else if( auto f = s->fn.target< WhileFunctor >() ) {
-                setExhandlerChain( f->c1, handler );
-            } else {
-                AASSERT4( AStep::EXEC == s->debugOpCode );
-            }
-        }
-        s = s->next;
+    } );
+}
+
+void CCode::setTokenChain( AStep* s, CancelToken* token ) {
+    walkChain( s, nullptr, [ & ]( AStep * s ) {
+        s->token = token;
+    } );
+}
+
+#ifdef ACCODE_PROFILING
+//First start of a program: its steps (including the ones in branches) learn which program they belong to
+void CCode::infraProfileChain( AStep* s ) {
+    const StepSite* program = s->site;
+    if( !program || program->program )
+        return;
+    walkChain( s, nullptr, [ & ]( AStep * p ) {
+        if( p->site && !p->site->program )
+            p->site->program = program;
+    } );
+}
+#endif
+
+//Steps of loop body or PAR branch s are owned by their LOOP/PAR step (see runChain())
+void CCode::setOwnedChain( AStep* s ) {
+    walkChain( s, nullptr, []( AStep * s ) {
+        s->owned = true;
+    } );
+}
+
+//Releases the future of WAIT (NB: owned WAIT keeps it until the loop is over, see runChain()), and deletes the step
+void CCode::releaseStep( AStep* s ) {
+    if( AStep::WAIT == s->debugOpCode ) {
+        stopWaiting( s );
+        AASSERT4( s->infraPtr->refCount > 0 );
+        if( !s->infraPtr->isDataReady() )
+            s->infraPtr->cleanup();
+        s->infraPtr->releaseRef();
+    }
+    s->debugDump( "    deleting after exception" );
+    delete s;
+}
+
+//Deletes a step which is not going to be executed, with its branches; owned steps are left to their loop
+void CCode::dropStep( AStep* s ) {
+    if( s->owned )
+        return;
+    if( s->hasBranches() ) {
+        deleteChain( s->branches.c1, nullptr );
+        deleteChain( s->branches.c2, nullptr );
     }
+    releaseStep( s );
 }
 
 void CCode::deleteChain( AStep* s, const AStep* e ) {
-    while( s ) {
-        if( s->infraPtr ) {
-            AASSERT4( AStep::WAIT == s->debugOpCode );
-            AASSERT4( s->infraPtr->refCount > 0 );
-            if( !s->infraPtr->isDataReady() )
-                s->infraPtr->cleanup();
-            s->infraPtr->refCount--;
-        } else {
-            AASSERT4( ( AStep::EXEC == s->debugOpCode ) || ( AStep::COND == s->debugOpCode ) || ( AStep::LOOP == s->debugOpCode ) );
-            if( auto f = s->fn.target< IifFunctor >() ) {
-                deleteChain( f->c1, e );
-            } else if( auto f = s->fn.target< EelseFunctor >() ) {
-                deleteChain( f->c1, e );
-                deleteChain( f->c2, e );
-            } else if( auto f = s->fn.target< WhileFunctor >() ) {
-                deleteChain( f->c1, e );
-            } else {
-                AASSERT4( AStep::EXEC == s->debugOpCode );
-            }
-        }
+    walkChain( s, e, releaseStep );
+}
 
-        auto tmp = s;
-        s = s->next;
-        tmp->debugDump( "    deleting after exception" );
-        tmp->refCount--;
-        AASSERT4( tmp->refCount >= 0 );
-        if( tmp->refCount <= 0 )
-            delete tmp;
-        if( tmp == e )
-            return;
+//Drops the failed step s and the steps after it, leaving branches and loops as we go
+//  toHandler: stops at the first step beyond the TTRY block of s, and returns it
+//  otherwise, drops the rest of the program and returns nullptr
+//  leaving PAR branch ends the branch, and the rest is up to joinBranch()
+AStep* CCode::unwind( AStep* s, bool toHandler ) {
+    AASSERT4( s );
+    int exId = s->exId;
+    int exDepth = s->exDepth;
+    //NB: steps of TTRY's nested in ours are deeper; a TTRY which comes right after ours is as deep, but has another id
+    auto beyondTry = [ & ]( const AStep * p ) {
+        return toHandler && ( p->exDepth < exDepth || ( p->exDepth == exDepth && p->exId != exId ) );
+    };
+    for( ;; ) {
+        AStep* next = s->next;
+        AStep* up = s->up;
+        dropStep( s );
+        while( !next ) {
+            if( !up )
+                return nullptr;
+            AStep* h = up;
+            if( AStep::PAR == h->debugOpCode )
+                return joinBranch( h, beyondTry( h ) ? AStep::PAR_OK : toHandler ? AStep::PAR_CAUGHT : AStep::PAR_FAILED );
+            next = h->next;
+            up = h->up;
+            if( !beyondTry( h ) )
+                dropStep( h );
+            else if( AStep::LOOP == h->debugOpCode )
+                return h;// TTRY block was the tail of the loop body
+        }
+        if( beyondTry( next ) )
+            return next;
+        s = next;
     }
 }
 
-AStep* CCode::deleteExChain( AStep* s ) {
-    int exId = s ? s->exId : 0;
-    while( s ) {
-        if( !s->exHandler || ( s->exId < exId ) )
-            return s;
-        if( s->infraPtr ) {
-            AASSERT4( AStep::WAIT == s->debugOpCode );
-            AASSERT4( s->infraPtr->refCount > 0 );
-            if( !s->infraPtr->isDataReady() )
-                s->infraPtr->cleanup();
-            s->infraPtr->refCount--;
-        } else {
-            AASSERT4( ( AStep::EXEC == s->debugOpCode ) || ( AStep::COND == s->debugOpCode ) || ( AStep::LOOP == s->debugOpCode ) );
-            if( auto f = s->fn.target< IifFunctor >() ) {
-                deleteChain( f->c1, nullptr );
-            } else if( auto f = s->fn.target< EelseFunctor >() ) {
-                deleteChain( f->c1, nullptr );
-                deleteChain( f->c2, nullptr );
-            } else if( auto f = s->fn.target< WhileFunctor >() ) {
-                deleteChain( f->c1, nullptr );
-            } else {
-                AASSERT4( AStep::EXEC == s->debugOpCode );
-            }
-        }
+//Continuations resumed while exec() is running (see resume()); per thread, as programs never go from one thread to another
+struct CCodeRunQueue {
+    std::vector< AStep* > items;
+    size_t head = 0;
+    bool running = false;
+    bool failed = false;//see fail()
+    ErrorStatus failure{ 0, nullptr };//our own copy, if failed
+};
+static thread_local CCodeRunQueue runQueue;
 
-        auto tmp = s;
-        s = s->next;
-        tmp->debugDump( "    deleting after exception" );
-        tmp->refCount--;
-        AASSERT4( tmp->refCount >= 0 );
-        if( tmp->refCount <= 0 )
-            delete tmp;
+//Runs s right away; continuations resumed meanwhile are run here too, one after another, once s is over or waits
+//  NB: program started from within a step of another one runs nested, right away, same as before; its continuations are queued though
+void CCode::exec( AStep* s ) {
+    if( runQueue.running ) {
+        //NB: fail() of the step starting us is not ours
+        const bool failed = runQueue.failed;
+        const ErrorStatus failure = runQueue.failure;
+        runQueue.failed = false;
+        runChain( s );
+        runQueue.failed = failed;
+        runQueue.failure = failure;
+        return;
     }
-    return nullptr;
-}
-
-
-void CCode::addRefChain( AStep* s, const AStep* e ) {
-    while( s ) {
-        AASSERT4( s->refCount > 0 );
-        s->refCount++;
-        if( !s->infraPtr ) {
-            AASSERT4( ( AStep::EXEC == s->debugOpCode ) || ( AStep::COND == s->debugOpCode ) || ( AStep::LOOP == s->debugOpCode ) );
-            if( auto f = s->fn.target< IifFunctor >() ) {
-                addRefChain( f->c1, e );
-            } else if( auto f = s->fn.target< EelseFunctor >() ) {
-                addRefChain( f->c1, e );
-                addRefChain( f->c2, e );
-            } else if( auto f = s->fn.target< WhileFunctor >() ) {
-                addRefChain( f->c1, e );
-            } else {
-                AASSERT4( AStep::EXEC == s->debugOpCode );
-            }
+    struct Running {
+        Running() {
+            runQueue.running = true;
         }
-        if( s == e )
-            break;
-        s = s->next;
-    }
+        //NB: also when an exception escapes runChain() (such as from a CCATCH handler): whatever is still queued is dropped,
+        //    rather than run by the next exec(), which has nothing to do with it
+        ~Running() {
+            runQueue.items.clear();
+            runQueue.head = 0;
+            runQueue.failed = false;
+            runQueue.running = false;
+        }
+    } running;
+    runChain( s );
+    while( runQueue.head < runQueue.items.size() )
+        runChain( runQueue.items[runQueue.head++] );
 }
 
-void CCode::exec( AStep* s ) {
-    while( s ) {
-        if( s->infraPtr ) {
-            AASSERT4( AStep::WAIT == s->debugOpCode );
+//Continuation of WAIT s: when called from within exec() (such as from a step which has completed a future right away,
+//  or from a handler), s is queued instead of nesting another exec(), so the stack doesn't grow with the number of programs involved
+void CCode::resume( AStep* s ) {
+    if( !s )
+        return;
+    if( runQueue.running )
+        runQueue.items.push_back( s );
+    else
+        exec( s );
+}
+
+void CCode::fail( ErrorStatus x ) {
+    AASSERT4( runQueue.running, "CCode::fail() outside of a step" );
+    runQueue.failed = true;
+    runQueue.failure = x;
+}
+
+//Step s has failed with x: goes to its handler (if any), and returns the step to execute next (see unwind())
+AStep* CCode::failStep( AStep* s, const std::exception& x ) {
+    if( s->exHandler )
+        s->exHandler( x );
+    return unwind( s, !!s->exHandler );
+}
+
+void CCode::runChain( AStep* s ) {
+    AStepStack forks;//second branches of PAR's, started once the current branch is over or waits
+    for( ;; ) {
+        if( !s ) {
+            if( forks.empty() )
+                return;
+            s = forks.pop();
+        }
+        if( s->token && s->token->cancelled ) {
+            s = unwind( s, false );
+            continue;
+        }
+        AStep* next;
+        bool keep = false;//LOOP which will be back, or PAR waiting for its branches
+        //NB: owned step MAY be gone after successor() (if it ends a PAR which is over), so we don't look at it afterwards
+        const bool owned = s->owned;
+#ifdef ACCODE_PROFILING
+        InfraProfileTimer timer( s->site ? &s->site->run : nullptr );
+#endif
+        if( AStep::WAIT == s->debugOpCode ) {
             AASSERT4( s->infraPtr->refCount > 0 );
             if( s->infraPtr->isDataReady() ) {
-                s->infraPtr->refCount--;
+                if( !s->owned )
+                    s->infraPtr->releaseRef();
                 INFRATRACE4( "Processing event {} cnt {} ...", ( void* )s->infraPtr, s->infraPtr->refCount );
+            } else if( s->infraPtr->isFailed() ) {
+                //NB: the error stays valid while unwinding, as the InfraFuture is not reclaimed before Node::futureCleanup()
+                s = failStep( s, s->infraPtr->infraGetError() );
+                continue;
             } else {
                 INFRATRACE4( "Waiting event {} cnt {} ...", ( void* )s->infraPtr, s->infraPtr->refCount );
                 s->setStepReady();
-                return;
+                startWaiting( s );
+                s = nullptr;
+                continue;
             }
+            next = successor( s );
         } else {
-            AASSERT4( ( AStep::EXEC == s->debugOpCode ) || ( AStep::COND == s->debugOpCode ) || ( AStep::LOOP == s->debugOpCode ) );
             try {
-                s->fn( nullptr );
-            } catch( const std::exception& x ) {
-                if( s->exHandler ) {
-                    s->exHandler( x );
-                    s = deleteExChain( s );
-                    continue;
-                } else {
-                    deleteChain( s, nullptr );
-                    return;
+                switch( s->debugOpCode ) {
+                    case AStep::EXEC:
+                        s->fn( nullptr );
+                        next = runQueue.failed ? nullptr : successor( s );
+                        break;
+                    case AStep::COND:
+                        next = execCond( s );
+                        break;
+                    case AStep::LOOP:
+                        keep = s->branches.b->getResult();
+                        next = keep ? s->branches.c1 : exitLoop( s );
+                        break;
+                    case AStep::PAR:
+                        AASSERT4( s->branches.c2, "PPARALLEL without AAND" );
+                        s->branches.pending = 2;
+                        s->branches.failure = AStep::PAR_OK;
+                        forks.push( s->branches.c2 );
+                        next = s->branches.c1;
+                        keep = true;
+                        break;
+                    default:
+                        AASSERT4( false, "unexpected AStep '{}'", s->debugOpCode );
+                        next = nullptr;
                 }
+            } catch( const std::exception& x ) {
+                runQueue.failed = false;
+                s = failStep( s, x );
+                continue;
+            }
+            if( runQueue.failed ) {
+                const ErrorStatus x = runQueue.failure;//NB: a handler MAY fail() too, once it starts a program of its own
+                runQueue.failed = false;
+                s = failStep( s, x );
+                continue;
             }
         }
 
-        auto tmp = s;
-        if( s->nextExec )
-            s = s->nextExec;
-        else
-            s = s->next;
-        tmp->debugDump( "    deleting main" );
-        tmp->refCount--;
-        AASSERT4( tmp->refCount >= 0 );
-        if( tmp->refCount <= 0 )
-            delete tmp;
+        if( !keep && !owned ) {
+            s->debugDump( "    deleting main" );
+            delete s;
+        }
+        s = next;
     }
 }
 
-}
\ No newline at end of file
+}
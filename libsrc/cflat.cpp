@@ -0,0 +1,168 @@
+/*******************************************************************************
+Copyright (C) 2016 OLogN Technologies AG
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*******************************************************************************/
+
+#include "../include/cflat.h"
+
+namespace autom {
+
+void CFlatSteps::append( CFlatSteps&& other ) {
+    if( code.empty() ) {
+        code = std::move( other.code );
+    } else {
+        int handlerBase = static_cast< int >( handlers.size() );
+        code.reserve( code.size() + other.code.size() );
+        for( auto& instr : other.code ) {
+            code.push_back( std::move( instr ) );
+            if( code.back().op == COP::TRY && code.back().handler >= 0 )
+                code.back().handler += handlerBase;
+        }
+    }
+    if( handlers.empty() ) {
+        handlers = std::move( other.handlers );
+    } else {
+        for( auto& h : other.handlers )
+            handlers.push_back( std::move( h ) );
+    }
+}
+
+void CFlatSteps::infraEndTry() {
+    AASSERT4( code[0].op == COP::TRY );
+    code[0].jump = size();
+    for( int i = 1; i < size(); i++ ) {
+        if( !code[i].tryOff )
+            code[i].tryOff = -i;
+    }
+}
+
+void CFlatSteps::infraEndCond() {
+    AASSERT4( code[0].op == COP::COND );
+    code[0].jump = size();
+}
+
+void CFlatSteps::infraEndLoop() {
+    AASSERT4( code[0].op == COP::LOOP );
+    code.push_back( CInstr( COP::JUMP ) );
+    code.back().jump = 1 - size();
+    code[0].jump = size();
+}
+
+struct CFlatWakeup {
+    CFlatRun* r;
+
+    explicit CFlatWakeup( CFlatRun* r_ ) : r( r_ ) {}
+    void operator()( const std::exception* ex ) const {
+        r->wakeup( ex );
+    }
+};
+
+//Finds the innermost TRY with a handler, calls the handler and moves pc to the end of its block
+//  exception thrown by the handler goes to the TRY enclosing its one, the same way
+//  returns false if there is no such TRY (and the program is to be terminated)
+bool CFlatRun::unwind( const std::exception& x ) {
+    size_t t = pc;
+    for( ;; ) {
+        if( !program[t].tryOff )
+            return false;
+        t += program[t].tryOff;
+        AASSERT4( program[t].op == COP::TRY );
+        if( program[t].handler >= 0 )
+            break;
+    }
+    INFRATRACE4( "CFlatRun {}: exception at {}, handled at {}", ( void* )this, pc, t );
+    pc = t;
+    try {
+        program.handle( program[t].handler, frame, x );
+    } catch( const std::exception& y ) {
+        return unwind( y );
+    }
+    pc = t + program[t].jump;
+    return true;
+}
+
+void CFlatRun::wakeup( const std::exception* ex ) {
+    AASSERT4( pc < program.size() && program[pc].op == COP::WAIT );
+    if( ex ) {
+        if( !unwind( *ex ) ) {
+            delete this;
+            return;
+        }
+    } else {
+        AASSERT4( program[pc].future( frame )->isDataReady() );
+        pc++;
+    }
+    exec();
+}
+
+void CFlatRun::exec() {
+    while( pc < program.size() ) {
+        const CInstr& instr = program[pc];
+        switch( instr.op ) {
+            case COP::EXEC:
+                try {
+                    instr.fn( frame );
+                } catch( const std::exception& x ) {
+                    if( !unwind( x ) ) {
+                        delete this;
+                        return;
+                    }
+                    continue;
+                }
+                pc++;
+                break;
+            case COP::WAIT: {
+                InfraFutureBase* f = instr.future( frame );
+                if( f->isFailed() ) {
+                    //NB: it has failed before we got here, and won't fire again
+                    if( !unwind( f->infraGetError() ) ) {
+                        delete this;
+                        return;
+                    }
+                    continue;
+                }
+                if( !f->isDataReady() ) {
+                    INFRATRACE4( "CFlatRun {}: waiting event {} at {}", ( void* )this, ( void* )f, pc );
+                    f->infraAddThen( CFlatWakeup( this ) );
+                    return;
+                }
+                pc++;
+                break;
+            }
+            case COP::COND:
+            case COP::LOOP: {
+                bool c;
+                try {
+                    c = instr.condition( frame );//NB: throws if the future is not ready
+                } catch( const std::exception& x ) {
+                    if( !unwind( x ) ) {
+                        delete this;
+                        return;
+                    }
+                    continue;
+                }
+                pc += c ? 1 : instr.jump;
+                break;
+            }
+            case COP::JUMP:
+                pc += instr.jump;
+                break;
+            case COP::TRY:
+                pc++;
+                break;
+        }
+    }
+    INFRATRACE4( "CFlatRun {}: done", ( void* )this );
+    delete this;
+}
+
+}
@@ -0,0 +1,151 @@
+/*******************************************************************************
+Copyright (C) 2016 OLogN Technologies AG
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*******************************************************************************/
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include "../include/cprofile.h"
+#include "infra/infraconsole.h"
+
+namespace autom {
+
+uint64_t InfraHistogram::percentile( double p ) const {
+    uint64_t target = static_cast< uint64_t >( p * count );
+    uint64_t seen = 0;
+    for( int i = 0; i < BUCKETS - 1; ++i ) {
+        seen += buckets[i];
+        if( seen > target )
+            return uint64_t( 1 ) << ( i + 1 );
+    }
+    return max;
+}
+
+uint64_t infraProfileCpuNow() {
+#ifdef _WIN32
+    FILETIME creation, exit, kernel, user;
+    GetThreadTimes( GetCurrentThread(), &creation, &exit, &kernel, &user );
+    uint64_t t = ( uint64_t( kernel.dwHighDateTime ) << 32 | kernel.dwLowDateTime ) + ( uint64_t( user.dwHighDateTime ) << 32 | user.dwLowDateTime );
+    return t * 100;
+#else
+    timespec ts;
+    clock_gettime( CLOCK_THREAD_CPUTIME_ID, &ts );
+    return uint64_t( ts.tv_sec ) * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+#ifdef ACCODE_PROFILING
+
+//Sites constructed by the current thread (see ACCODE_SITE())
+static thread_local StepSite* threadSites = nullptr;
+
+StepSite::StepSite( const char* file_, int line_ ) : file( file_ ), line( line_ ) {
+    nextSite = threadSites;
+    threadSites = this;
+}
+
+static std::string formatDuration( uint64_t ns ) {
+    if( ns < 10000 )
+        return fmt::format( "{}ns", ns );
+    if( ns < 10000000 )
+        return fmt::format( "{}us", ns / 1000 );
+    if( ns < 10000000000ULL )
+        return fmt::format( "{}ms", ns / 1000000 );
+    return fmt::format( "{}s", ns / 1000000000 );
+}
+
+static std::string formatHistogram( const InfraHistogram& h ) {
+    return fmt::format( "{} x, total {}, p50 <{}, p99 <{}, max {}", h.count, formatDuration( h.total ), formatDuration( h.percentile( 0.5 ) ),
+                        formatDuration( h.percentile( 0.99 ) ), formatDuration( h.max ) );
+}
+
+void StepSite::report() {
+    std::vector< const StepSite* > sites;
+    for( const StepSite* s = threadSites; s; s = s->nextSite ) {
+        if( s->program && ( s->run.count || s->wait.count ) )
+            sites.push_back( s );
+    }
+
+    struct Program {
+        const StepSite* site;
+        uint64_t total;
+    };
+    std::vector< Program > programs;
+    for( auto s : sites ) {
+        auto it = std::find_if( programs.begin(), programs.end(), [ & ]( const Program & p ) {
+            return p.site == s->program;
+        } );
+        if( it == programs.end() ) {
+            programs.push_back( Program{ s->program, 0 } );
+            it = programs.end() - 1;
+        }
+        it->total += s->run.total;
+    }
+    std::sort( programs.begin(), programs.end(), []( const Program & a, const Program & b ) {
+        return a.total > b.total;
+    } );
+    std::stable_sort( sites.begin(), sites.end(), []( const StepSite * a, const StepSite * b ) {
+        return a->run.total > b->run.total;
+    } );
+
+    infraConsole.log( "CCode profile: {} programs", programs.size() );
+    for( const auto& p : programs ) {
+        infraConsole.log( "program {}:{}, {} cpu in steps", p.site->file, p.site->line, formatDuration( p.total ) );
+        for( auto s : sites ) {
+            if( s->program != p.site )
+                continue;
+            infraConsole.log( "  {}:{} '{}' run (cpu): {}", s->file, s->line, s->op, formatHistogram( s->run ) );
+            if( s->wait.count )
+                infraConsole.log( "  {}:{} '{}' wait: {}", s->file, s->line, s->op, formatHistogram( s->wait ) );
+        }
+    }
+}
+
+void StepSite::reset() {
+    for( StepSite* s = threadSites; s; s = s->nextSite ) {
+        s->run.reset();
+        s->wait.reset();
+    }
+}
+
+const StepSite* StepSite::find( const char* file, int line, char op ) {
+    for( const StepSite* s = threadSites; s; s = s->nextSite ) {
+        if( s->line == line && s->op == op && !strcmp( s->file, file ) )
+            return s;
+    }
+    return nullptr;
+}
+
+#else
+
+void StepSite::report() {
+    infraConsole.log( "CCode profile: not compiled in (see ACCODE_PROFILING)" );
+}
+
+void StepSite::reset() {}
+
+const StepSite* StepSite::find( const char*, int, char ) {
+    return nullptr;
+}
+
+#endif
+
+}
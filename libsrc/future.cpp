@@ -0,0 +1,103 @@
+/*******************************************************************************
+Copyright (C) 2016 OLogN Technologies AG
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*******************************************************************************/
+
+#include <stdexcept>
+
+#include "../include/future.h"
+
+namespace autom {
+
+void InfraFutureGroup::add( InfraFutureBase* f ) {
+    AASSERT4( f );
+    AASSERT4( f->node == node );
+    AASSERT4( !f->multi );
+    const size_t idx = members.size();
+    members.push_back( nullptr );
+    if( done )
+        return;//whenAny() is already satisfied
+    if( f->isFailed() ) {
+        complete( 0, &f->infraGetError() );//NB: it won't fire again
+        return;
+    }
+    if( f->isDataReady() ) {
+        if( any )
+            complete( idx, nullptr );
+        return;
+    }
+    AASSERT4( !f->group, "Future is already a member of whenAll()/whenAny()" );
+    f->group = this;
+    f->groupIdx = idx;
+    f->refCount++;
+    refCount++;
+    members[idx] = f;
+    ++pending;
+}
+
+void InfraFutureGroup::infraSetupDone() {
+    if( !any && !done && !pending )
+        complete( members.size(), nullptr );
+}
+
+void InfraFutureGroup::detach( InfraFutureBase* f ) {
+    AASSERT4( f->group == this );
+    AASSERT4( members[f->groupIdx] == f );
+    members[f->groupIdx] = nullptr;
+    --pending;
+    f->group = nullptr;
+    //NB: both releases are deferred until Node::futureCleanup()
+    f->releaseRef();
+    releaseRef();
+}
+
+void InfraFutureGroup::complete( size_t value, const std::exception* ex ) {
+    AASSERT4( !done );
+    done = true;
+    //the rest of members are not needed anymore
+    for( size_t i = 0; pending && i < members.size(); ++i ) {
+        if( members[i] )
+            detach( members[i] );
+    }
+    if( !ex ) {
+        infraGetData() = value;
+        setDataReady();
+    }
+    infraFire( ex );
+    cleanup();
+}
+
+void InfraFutureGroup::infraMemberFired( InfraFutureBase* f, const std::exception* ex ) {
+    const size_t idx = f->groupIdx;
+    detach( f );
+    AASSERT4( !done );
+    if( ex )
+        complete( 0, ex );
+    else if( any )
+        complete( idx, nullptr );
+    else if( !pending )
+        complete( members.size(), nullptr );
+}
+
+Future< size_t > infraWhen( Node* node, bool any, const FutureBase* const* fs, size_t n ) {
+    AASSERT4( node );
+    if( any && !n )
+        throw std::invalid_argument( "whenAny() of no futures" );
+    auto g = infraNewFutureOf< InfraFutureGroup >( node, any );
+    Future< size_t > ret( node, g );
+    for( size_t i = 0; i < n; ++i )
+        g->add( fs[i]->infraGetPtr() );
+    g->infraSetupDone();
+    return ret;
+}
+
+}
@@ -0,0 +1,103 @@
+/*******************************************************************************
+Copyright (C) 2016 OLogN Technologies AG
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*******************************************************************************/
+
+
+#include "bufferpool.h"
+#include "../../include/aassert.h"
+#include <new>
+
+using namespace autom;
+
+InfraBufferPool::~InfraBufferPool() {
+    for( auto slab : slabs )
+        ::operator delete( slab );
+}
+
+size_t InfraBufferPool::classFor( size_t nread, size_t bufLen ) {
+    size_t cls = 0;
+    if( nread >= bufLen ) {
+        while( cls + 1 < CLASSES && classSize( cls ) <= bufLen )
+            ++cls;
+    } else {
+        while( cls + 1 < CLASSES && classSize( cls ) < nread )
+            ++cls;
+    }
+    return cls;
+}
+
+static size_t slabItems( size_t cls ) {
+    return InfraBufferPool::SLAB_SIZE / InfraBufferPool::classSize( cls );
+}
+
+void InfraBufferPool::addSlab( size_t cls ) {
+    const size_t size = itemSize( cls );
+    const size_t n = slabItems( cls );
+    char* slab = static_cast<char*>( ::operator new( size * n ) );
+    slabs.push_back( slab );
+    ++stats.slabs;
+    stats.slabBytes += size * n;
+
+    //threading all the items of a new slab into the free list
+    FreeItem* head = freeLists[cls];
+    for( size_t i = n; i > 0; --i ) {
+        char* p = slab + ( i - 1 ) * size;
+        reinterpret_cast<Header*>( p )->pool = this;
+        reinterpret_cast<Header*>( p )->cls = cls;
+        reinterpret_cast<Header*>( p )->fallback = false;
+        auto item = reinterpret_cast<FreeItem*>( p + HEADER_SIZE );
+        item->next = head;
+        head = item;
+    }
+    freeLists[cls] = head;
+}
+
+char* InfraBufferPool::allocate( size_t cls ) {
+    AASSERT4( cls < CLASSES );
+    ++stats.inUse;
+    ++stats.inUseByClass[cls];
+    if( freeLists[cls] ) {
+        ++stats.hits;
+    } else if( stats.slabBytes + itemSize( cls ) * slabItems( cls ) <= cap ) {
+        ++stats.misses;
+        addSlab( cls );
+    } else {
+        ++stats.fallbacks;
+        auto h = static_cast<Header*>( ::operator new( itemSize( cls ) ) );
+        h->pool = this;
+        h->cls = cls;
+        h->refCount = 1;
+        h->fallback = true;
+        return reinterpret_cast<char*>( h ) + HEADER_SIZE;
+    }
+
+    //removing first item from single-linked list
+    FreeItem* item = freeLists[cls];
+    freeLists[cls] = item->next;
+    header( reinterpret_cast<char*>( item ) )->refCount = 1;
+    return reinterpret_cast<char*>( item );
+}
+
+void InfraBufferPool::deallocate( Header* h ) {
+    AASSERT4( h->pool == this );
+    AASSERT4( stats.inUse > 0 );
+    --stats.inUse;
+    --stats.inUseByClass[h->cls];
+    if( h->fallback ) {
+        ::operator delete( h );
+        return;
+    }
+    auto item = reinterpret_cast<FreeItem*>( reinterpret_cast<char*>( h ) + HEADER_SIZE );
+    item->next = freeLists[h->cls];
+    freeLists[h->cls] = item;
+}
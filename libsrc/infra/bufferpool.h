@@ -0,0 +1,119 @@
+/*******************************************************************************
+Copyright (C) 2016 OLogN Technologies AG
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*******************************************************************************/
+
+
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+
+#include <cstddef>
+#include <vector>
+
+#include "../../include/aassert.h"
+
+namespace autom {
+
+//Per-LoopContainer pool of buffers, shared by all the sockets of the loop (each loop has one for received bytes, and one for write chunks)
+//  Buffers are carved from slabs, one free list per size class (4K, 16K and 64K);
+//  once slabs reach the cap, buffers which can't be taken from a free list are plain heap allocations (fallbacks).
+//  Each buffer is preceded by a small header, so that release() needs nothing but the pointer.
+//  Buffers are refcounted, as received bytes are handed over right in them (see NetworkBuffer);
+//  NB: not thread-safe, as everything on the loop's thread; buffers MUST NOT outlive the pool.
+//  Slab buffers are NEVER returned to the global heap until the pool itself is destroyed.
+class InfraBufferPool {
+  public:
+    static const size_t CLASSES = 3;
+    static const size_t SLAB_SIZE = 256 * 1024;
+    static const size_t DEFAULT_CAP = 4 * 1024 * 1024;
+
+    struct Stats {
+        size_t hits = 0;//buffers served from a free list
+        size_t misses = 0;//buffers which have needed a new slab
+        size_t fallbacks = 0;//buffers allocated on the heap, as slabs have reached the cap
+        size_t inUse = 0;
+        size_t inUseByClass[CLASSES] = {};
+        size_t slabs = 0;
+        size_t slabBytes = 0;
+    };
+
+    static size_t classSize( size_t cls ) {
+        return size_t( 4096 ) << ( 2 * cls );
+    }
+    //Size class for the next read of a stream, given how much the previous one has read into a buffer of bufLen
+    //  a full buffer means there is more to read, so the next one is bigger
+    static size_t classFor( size_t nread, size_t bufLen );
+
+  private:
+    struct FreeItem {
+        FreeItem* next;
+    };
+
+    //Precedes each buffer; keeps the buffer aligned as if it had come from operator new()
+    struct Header {
+        InfraBufferPool* pool;
+        size_t cls;
+        size_t refCount;
+        bool fallback;
+    };
+    static const size_t ALIGN = alignof( std::max_align_t );
+    static const size_t HEADER_SIZE = ( sizeof( Header ) + ALIGN - 1 ) / ALIGN * ALIGN;
+
+    static Header* header( const char* p ) {
+        return reinterpret_cast<Header*>( const_cast<char*>( p ) - HEADER_SIZE );
+    }
+    //NB: ALIGN bytes more than the class size, so that there is always room for a terminating '\0'
+    static size_t itemSize( size_t cls ) {
+        return HEADER_SIZE + classSize( cls ) + ALIGN;
+    }
+
+    FreeItem* freeLists[CLASSES] = {};
+    std::vector< void* > slabs;
+    size_t cap = DEFAULT_CAP;
+    Stats stats;
+
+    void addSlab( size_t cls );
+    void deallocate( Header* h );
+
+  public:
+    InfraBufferPool() = default;
+    InfraBufferPool( const InfraBufferPool& ) = delete;
+    InfraBufferPool& operator=( const InfraBufferPool& ) = delete;
+    ~InfraBufferPool();
+
+    //Max bytes in slabs; slabs already there are kept even if the new cap is lower
+    void setCap( size_t bytes ) {
+        cap = bytes;
+    }
+    //Returns a buffer of classSize( cls ) bytes (plus one for '\0'), with a single reference
+    char* allocate( size_t cls );
+    static void addRef( const char* p ) {
+        ++header( p )->refCount;
+    }
+    //Buffer goes back to its pool once the last reference is gone; nullptr is fine
+    static void release( const char* p ) {
+        if( !p )
+            return;
+        Header* h = header( p );
+        AASSERT4( h->refCount > 0 );
+        if( !--h->refCount )
+            h->pool->deallocate( h );
+    }
+
+    const Stats& getStats() const {
+        return stats;
+    }
+};
+
+}
+
+#endif
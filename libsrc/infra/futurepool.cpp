@@ -0,0 +1,80 @@
+/*******************************************************************************
+Copyright (C) 2016 OLogN Technologies AG
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*******************************************************************************/
+
+#include "futurepool.h"
+#include "../../include/aassert.h"
+#include <new>
+
+using namespace autom;
+
+InfraFuturePool::~InfraFuturePool() {
+    for( auto slab : slabs )
+        ::operator delete( slab );
+}
+
+void InfraFuturePool::addSlab( size_t cls ) {
+    const size_t itemSize = cls * GRANULARITY;
+    char* slab = static_cast<char*>( ::operator new( itemSize * OBJECTS_PER_SLAB ) );
+    slabs.push_back( slab );
+    ++stats.slabs;
+
+    //threading all the items of a new slab into the free list
+    FreeItem* head = freeLists[cls];
+    for( size_t i = OBJECTS_PER_SLAB; i > 0; --i ) {
+        auto item = reinterpret_cast<FreeItem*>( slab + ( i - 1 ) * itemSize );
+        item->next = head;
+        head = item;
+    }
+    freeLists[cls] = head;
+}
+
+void* InfraFuturePool::allocate( size_t sz ) {
+    AASSERT4( sz > 0 );
+    ++stats.inUse;
+    if( sz > MAX_POOLED_SIZE ) {
+        ++stats.misses;
+        return ::operator new( sz );
+    }
+
+    const size_t cls = sizeClass( sz );
+    if( cls >= freeLists.size() )
+        freeLists.resize( cls + 1, nullptr );
+    if( freeLists[cls] ) {
+        ++stats.hits;
+    } else {
+        ++stats.misses;
+        addSlab( cls );
+    }
+
+    //removing first item from single-linked list
+    FreeItem* item = freeLists[cls];
+    freeLists[cls] = item->next;
+    return item;
+}
+
+void InfraFuturePool::deallocate( void* p, size_t sz ) {
+    AASSERT4( p );
+    AASSERT4( stats.inUse > 0 );
+    --stats.inUse;
+    if( sz > MAX_POOLED_SIZE ) {
+        ::operator delete( p );
+        return;
+    }
+
+    const size_t cls = sizeClass( sz );
+    AASSERT4( cls < freeLists.size() );
+    auto item = static_cast<FreeItem*>( p );
+    item->next = freeLists[cls];
+    freeLists[cls] = item;
+}
@@ -0,0 +1,71 @@
+/*******************************************************************************
+Copyright (C) 2016 OLogN Technologies AG
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*******************************************************************************/
+
+#ifndef FUTUREPOOL_H
+#define FUTUREPOOL_H
+
+#include <stddef.h>
+#include <vector>
+
+namespace autom {
+
+//Per-Node pool for InfraFuture<T> objects
+//  Memory is carved from slabs, one free list per size class;
+//  as all InfraFuture<T> with the same sizeof() share a size class,
+//  this is effectively a per-T pool without any per-type registration.
+//  Freed objects are NEVER returned to the global heap until the pool itself is destroyed.
+class InfraFuturePool {
+  public:
+    static const size_t GRANULARITY = 16;//MUST be a multiple of alignof( max_align_t )
+    static const size_t OBJECTS_PER_SLAB = 64;
+    static const size_t MAX_POOLED_SIZE = 1024;
+
+    struct Stats {
+        size_t hits = 0;//allocations served from a free list
+        size_t misses = 0;//allocations which had to go to the global heap (new slab or oversized object)
+        size_t inUse = 0;
+        size_t slabs = 0;
+    };
+
+  private:
+    struct FreeItem {
+        FreeItem* next;
+    };
+
+    std::vector< FreeItem* > freeLists;//indexed by size class
+    std::vector< void* > slabs;
+    Stats stats;
+
+    static size_t sizeClass( size_t sz ) {
+        return ( sz + GRANULARITY - 1 ) / GRANULARITY;
+    }
+    void addSlab( size_t cls );
+
+  public:
+    InfraFuturePool() = default;
+    InfraFuturePool( const InfraFuturePool& ) = delete;
+    InfraFuturePool& operator=( const InfraFuturePool& ) = delete;
+    ~InfraFuturePool();
+
+    void* allocate( size_t sz );
+    void deallocate( void* p, size_t sz );
+
+    const Stats& getStats() const {
+        return stats;
+    }
+};
+
+}
+
+#endif
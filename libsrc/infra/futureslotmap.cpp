@@ -0,0 +1,71 @@
+/*******************************************************************************
+Copyright (C) 2016 OLogN Technologies AG
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*******************************************************************************/
+
+#include "futureslotmap.h"
+#include "../../include/aassert.h"
+#include "../../include/future.h"
+
+using namespace autom;
+
+static void destroyInfraFuture( InfraFuturePool& pool, InfraFutureBase* f ) {
+    const size_t sz = f->infraSize();
+    f->~InfraFutureBase();
+    pool.deallocate( f, sz );
+}
+
+InfraFutureSlotMap::~InfraFutureSlotMap() {
+    for( size_t i = 0; i < slots.size(); ++i ) {
+        if( slots[i].ptr )
+            destroyInfraFuture( pool, slots[i].ptr );
+    }
+}
+
+FutureId InfraFutureSlotMap::insert( InfraFutureBase* inf ) {
+    AASSERT4( inf );
+    uint32_t idx;
+    if( firstFree == NONE ) {
+        AASSERT4( slots.size() < NONE );
+        idx = static_cast<uint32_t>( slots.size() );
+        slots.push_back( Slot() );
+    } else {
+        //removing first item from single-linked list
+        idx = firstFree;
+        firstFree = slots[idx].nextFree;
+    }
+    Slot& s = slots[idx];
+    AASSERT4( !s.ptr );
+    s.ptr = inf;
+    s.nextFree = NONE;
+    ++used;
+    return makeId( idx, s.generation );
+}
+
+void InfraFutureSlotMap::erase( FutureId id ) {
+    AASSERT4( find( id ), "Stale or unknown FutureId" );
+    eraseSlot( idIndex( id ) );
+}
+
+void InfraFutureSlotMap::eraseSlot( size_t idx ) {
+    Slot& s = slots[idx];
+    AASSERT4( s.ptr );
+    destroyInfraFuture( pool, s.ptr );
+    s.ptr = nullptr;
+    if( ++s.generation == 0 )
+        s.generation = 1;
+
+    //inserting to the head of single-linked list
+    s.nextFree = firstFree;
+    firstFree = static_cast<uint32_t>( idx );
+    --used;
+}
@@ -0,0 +1,96 @@
+/*******************************************************************************
+Copyright (C) 2016 OLogN Technologies AG
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*******************************************************************************/
+
+#ifndef FUTURESLOTMAP_H
+#define FUTURESLOTMAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace autom {
+
+class InfraFutureBase;
+class InfraFuturePool;
+
+//FutureId is {generation:32, index:32}
+//  index is a position within InfraFutureSlotMap::slots
+//  generation is bumped each time the slot is released, so a stale FutureId
+//    (one referring to an already-destroyed InfraFuture) never matches again
+//  generation is never 0, so FutureId 0 is never issued and MAY be used as 'no future'
+using FutureId = uint64_t;
+
+class InfraFutureSlotMap {
+    static const uint32_t NONE = static_cast<uint32_t>( -1 );
+
+    struct Slot {
+        InfraFutureBase* ptr = nullptr;//owning
+        uint32_t generation = 1;
+        uint32_t nextFree = NONE;
+    };
+
+    InfraFuturePool& pool;//where InfraFutures are returned on erase
+    std::vector< Slot > slots;
+    uint32_t firstFree = NONE;
+    //'sparse' vector with firstFree forming single-linked list in nextFree items
+    size_t used = 0;
+
+    static uint32_t idIndex( FutureId id ) {
+        return static_cast<uint32_t>( id );
+    }
+    static uint32_t idGeneration( FutureId id ) {
+        return static_cast<uint32_t>( id >> 32 );
+    }
+    static FutureId makeId( uint32_t idx, uint32_t generation ) {
+        return ( static_cast<FutureId>( generation ) << 32 ) | idx;
+    }
+
+  public:
+    explicit InfraFutureSlotMap( InfraFuturePool& pool_ ) : pool( pool_ ) {}
+    InfraFutureSlotMap( const InfraFutureSlotMap& ) = delete;
+    InfraFutureSlotMap& operator=( const InfraFutureSlotMap& ) = delete;
+    ~InfraFutureSlotMap();
+
+    //takes ownership of inf, which MUST be allocated from pool
+    FutureId insert( InfraFutureBase* inf );
+    void erase( FutureId id );
+
+    InfraFutureBase* find( FutureId id ) const {
+        const uint32_t idx = idIndex( id );
+        if( idx >= slots.size() )
+            return nullptr;
+        const Slot& s = slots[idx];
+        return s.generation == idGeneration( id ) ? s.ptr : nullptr;
+    }
+
+    size_t size() const {
+        return used;
+    }
+
+    //slot-level access, for whole-map walks (cleanup, dumps)
+    size_t slotCount() const {
+        return slots.size();
+    }
+    InfraFutureBase* atSlot( size_t idx ) const {
+        return slots[idx].ptr;
+    }
+    FutureId idAtSlot( size_t idx ) const {
+        return makeId( static_cast<uint32_t>( idx ), slots[idx].generation );
+    }
+    void eraseSlot( size_t idx );
+};
+
+}
+
+#endif
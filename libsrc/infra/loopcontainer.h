@@ -16,23 +16,88 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #define LOOPCONTAINER_H
 
 #include "../../3rdparty/libuv/include/uv.h"
+#include "bufferpool.h"
+#include <algorithm>
+#include <vector>
 
 namespace autom {
 
+//Something which needs to run once it has been scheduled with LoopContainer::infraSchedule(),
+//  but not right away (such as draining Node's event queue)
+class InfraLoopTask {
+  public:
+    virtual void infraRunLoopTask() = 0;
+
+  protected:
+    ~InfraLoopTask() {}
+};
+
 class LoopContainer {
     uv_loop_t uvLoop;
+    uv_prepare_t prepare;//runs scheduled tasks; active only while there are any
+    std::vector< InfraLoopTask* > tasks;
+    std::vector< InfraLoopTask* > running;//taken from tasks by prepareCb(); nullptr for the ones unscheduled meanwhile
+    InfraBufferPool recvBuffers;//received bytes of all the sockets of the loop
+    InfraBufferPool writeBuffers;//chunks of write batches (see zeronet.cpp), so that writing doesn't use up receive slabs
+
+    static void prepareCb( uv_prepare_t* handle ) {
+        auto self = static_cast<LoopContainer*>( handle->data );
+        //NB: tasks MAY schedule more, or unschedule (and destroy) the ones which haven't run yet, while we're here
+        while( !self->tasks.empty() ) {
+            self->running.swap( self->tasks );
+            for( size_t i = 0; i < self->running.size(); ++i ) {
+                if( auto t = self->running[i] )
+                    t->infraRunLoopTask();
+            }
+            self->running.clear();
+        }
+        uv_prepare_stop( handle );
+    }
 
   public :
     LoopContainer() {
         uv_loop_init( &uvLoop );
+        uvLoop.data = this;
+        uv_prepare_init( &uvLoop, &prepare );
+        prepare.data = this;
     }
+    LoopContainer( const LoopContainer& ) = delete;
+    LoopContainer& operator=( const LoopContainer& ) = delete;
     ~LoopContainer() {
+        uv_close( reinterpret_cast<uv_handle_t*>( &prepare ), nullptr );
+        uv_run( &uvLoop, UV_RUN_NOWAIT );
         uv_loop_close( &uvLoop );
     }
 
     uv_loop_t* infraLoop() {
         return &uvLoop;
     }
+    InfraBufferPool& infraRecvBuffers() {
+        return recvBuffers;
+    }
+    InfraBufferPool& infraWriteBuffers() {
+        return writeBuffers;
+    }
+    //Max bytes in receive buffer slabs (see InfraBufferPool)
+    void setRecvBufferCap( size_t bytes ) {
+        recvBuffers.setCap( bytes );
+    }
+    //Max bytes in write chunk slabs; NB: large payloads written with TcpZeroSocket::write( std::string&& ) don't take any
+    void setWriteBufferCap( size_t bytes ) {
+        writeBuffers.setCap( bytes );
+    }
+
+    //t runs within the current loop iteration if scheduled from timer callbacks,
+    //  otherwise - on the next one, right before polling for I/O
+    void infraSchedule( InfraLoopTask* t ) {
+        if( tasks.empty() )
+            uv_prepare_start( &prepare, prepareCb );
+        tasks.push_back( t );
+    }
+    void infraUnschedule( InfraLoopTask* t ) {
+        tasks.erase( std::remove( tasks.begin(), tasks.end(), t ), tasks.end() );
+        std::replace( running.begin(), running.end(), t, static_cast< InfraLoopTask* >( nullptr ) );
+    }
 
     void run() {
         uv_run( &uvLoop, UV_RUN_DEFAULT );
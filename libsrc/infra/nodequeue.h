@@ -0,0 +1,66 @@
+/*******************************************************************************
+Copyright (C) 2016 OLogN Technologies AG
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*******************************************************************************/
+
+#ifndef NODEQUEUE_H
+#define NODEQUEUE_H
+
+#include <stddef.h>
+#include <utility>
+#include <vector>
+
+#include "../../include/aassert.h"
+
+namespace autom {
+
+//FIFO over a contiguous ring, growing (by doubling) when full
+//  T MUST be default-constructible and move-assignable; popped slots are left moved-from
+template< typename T >
+class InfraQueue {
+    std::vector< T > ring;
+    size_t head = 0;
+    size_t count = 0;
+
+    void grow() {
+        std::vector< T > bigger( ring.empty() ? 16 : ring.size() * 2 );
+        for( size_t i = 0; i < count; ++i )
+            bigger[i] = std::move( ring[( head + i ) % ring.size()] );
+        ring.swap( bigger );
+        head = 0;
+    }
+
+  public:
+    bool empty() const {
+        return count == 0;
+    }
+    size_t size() const {
+        return count;
+    }
+    void push( T&& item ) {
+        if( count == ring.size() )
+            grow();
+        ring[( head + count ) % ring.size()] = std::move( item );
+        ++count;
+    }
+    T pop() {
+        AASSERT4( count > 0 );
+        T ret = std::move( ring[head] );
+        head = ( head + 1 ) % ring.size();
+        --count;
+        return ret;
+    }
+};
+
+}
+
+#endif
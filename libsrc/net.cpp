@@ -30,12 +30,40 @@ MultiFuture< Buffer > TcpSocket::read() const {
         NodeQBuffer item;
         item.id = id;
         item.b = *b;
-        nd->infraProcessTcpRead( item );
+        nd->infraPost( NodeQEvent( NODEQ::READ, std::move( item ) ) );
     } );
-    zero.on( TcpZeroSocket::ID_CLOSED, [id, nd]() {
+    zero.on( TcpZeroSocket::ID_CLOSED, [id, nd]( int status ) {
         NodeQClosed item;
         item.id = id;
-        nd->infraProcessTcpClosed( item );
+        item.code = status ? ErrorStatus::RESET : ErrorStatus::CLOSED;
+        nd->infraPost( NodeQEvent( item ) );
+    } );
+    zero.read();
+    return future;
+}
+
+BufferedMultiFuture< Buffer > TcpSocket::read( size_t highWater, size_t lowWater ) const {
+    BufferedMultiFuture< Buffer > future( node, highWater, lowWater );
+    auto id = future.infraGetId();
+    auto nd = node;
+    auto zs = zero;
+    future.infraSetFlowControl( [zs]( bool pause ) {
+        if( pause )
+            zs.pauseRead();
+        else
+            zs.resumeRead();
+    } );
+    zero.on( TcpZeroSocket::ID_DATA, [id, nd]( const NetworkBuffer * b ) {
+        NodeQBuffer item;
+        item.id = id;
+        item.b = *b;
+        nd->infraPost( NodeQEvent( NODEQ::READ_BUFFERED, std::move( item ) ) );
+    } );
+    zero.on( TcpZeroSocket::ID_CLOSED, [id, nd]( int status ) {
+        NodeQClosed item;
+        item.id = id;
+        item.code = status ? ErrorStatus::RESET : ErrorStatus::CLOSED;
+        nd->infraPost( NodeQEvent( item ) );
     } );
     zero.read();
     return future;
@@ -45,6 +73,14 @@ void TcpSocket::write( const void* buff, size_t sz ) const {
     zero.write( buff, sz );
 }
 
+void TcpSocket::write( std::string&& payload ) const {
+    zero.write( std::move( payload ) );
+}
+
+void TcpSocket::write( const NetworkBuffer& buff ) const {
+    zero.write( buff );
+}
+
 void TcpSocket::close() const {
     zero.close();
 }
@@ -57,17 +93,18 @@ MultiFuture< TcpSocket > TcpServer::listen( int port ) {
     auto nd = node;
     zero.on( ID_CONNECT, [id, nd]( TcpZeroSocket zs ) {
         NodeQAccept item;
-        TcpSocket s;
-        s.zero = zs;
-        s.node = nd;
         item.id = id;
-        item.sock = &s;
-        nd->infraProcessTcpAccept( item );
+        item.zero = zs;
+        nd->infraPost( NodeQEvent( item ) );
     } );
 
     return future;
 }
 
+void TcpServer::close() {
+    zero.close();
+}
+
 Future< TcpSocket > net::connect( Node* node, const char* addr, int port ) {
     auto sock = new TcpSocket;
     sock->zero = net::connect( node->parentLoop, addr, port );
@@ -78,18 +115,20 @@ Future< TcpSocket > net::connect( Node* node, const char* addr, int port ) {
     sock->zero.on( TcpZeroSocket::ID_CONNECT, [id, node, sock]() {
         NodeQConnect item;
         item.id = id;
-        item.sock = sock;
-        node->infraProcessTcpConnect( item );
+        item.zero = sock->zero;
+        node->infraPost( NodeQEvent( item ) );
     } );
     sock->zero.on( TcpZeroSocket::ID_ERROR, [id, node]() {
         NodeQClosed item;
         item.id = id;
-        node->infraProcessTcpClosed( item );
+        item.code = ErrorStatus::CONNECT_FAILED;
+        node->infraPost( NodeQEvent( item ) );
     } );
     return future;
 }
 
-std::exception* Buffer::fromNetwork( const NetworkBuffer& b ) {
-    s = b;
+const ErrorStatus* Buffer::fromNetwork( const NetworkBuffer& b ) {
+    received = b;
+    s.clear();
     return nullptr;
 }
@@ -24,17 +24,26 @@ void autom::startTimeout( const Future< Timer >& future, Node* node, unsigned se
     startTimeout( node->parentLoop, [node, id]() {
         NodeQTimer item;
         item.id = id;
-        node->infraProcessTimer( item );
+        node->infraPost( NodeQEvent( item ) );
     }, secDelay );
 }
 
+ZeroTimeout autom::startTimeoutMs( const Future< Timer >& future, Node* node, unsigned msDelay ) {
+    FutureId id = future.infraGetId();
+    return startCancellableTimeoutMs( node->parentLoop, [node, id]() {
+        NodeQTimer item;
+        item.id = id;
+        node->infraPost( NodeQEvent( item ) );
+    }, msDelay );
+}
+
 autom::Future< Timer > autom::startTimeout( Node* node, unsigned secDelay ) {
     Future< Timer > future( node );
     FutureId id = future.infraGetId();
     startTimeout( node->parentLoop, [node, id]() {
         NodeQTimer item;
         item.id = id;
-        node->infraProcessTimer( item );
+        node->infraPost( NodeQEvent( item ) );
     }, secDelay );
     return future;
 }
@@ -45,7 +54,7 @@ MultiFuture< Timer > autom::setInterval( Node* node, unsigned secRepeat ) {
     setInterval( node->parentLoop, [node, id]() {
         NodeQTimer item;
         item.id = id;
-        node->infraProcessTimer( item );
+        node->infraPost( NodeQEvent( item ) );
     }, secRepeat );
 
     return future;
@@ -16,29 +16,62 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "../include/abuffer.h"
 #include "../include/zeronet.h"
 #include "infra/loopcontainer.h"
+#include <cstring>
 #include <map>
+#include <vector>
 
 namespace autom {
 
 class ListenerInterface;
 class StreamInteface;
 
-class StreamInteface {
+//What keeps the bytes of one uv_buf_t of a batch: a chunk of the loop's write buffers (the bytes are copied there),
+//  a pool buffer shared with NetworkBuffer's, or a payload handed over by the caller
+struct ZeroWriteRef {
+    const char* pooled;//we hold a reference
+    std::string* payload;
+    bool chunk;//MAY take more bytes
+};
+
+//Bytes written to a socket within one loop iteration: small ones are gathered in chunks from the loop's write buffers,
+//  large ones are referenced as they are; then, those of them which uv_try_write() hasn't written right away, while uv_write() of them is in flight
+//  NB: pooled per thread (see takeBatch()), as they never leave the loop's thread
+struct ZeroWriteBatch {
+    uv_write_t req;
+    Handle h;
+    std::vector< ZeroWriteRef > refs;//one per buf, to be released
+    std::vector< uv_buf_t > bufs;//what is still to be written
+    ZeroWriteBatch* nextFree = nullptr;
+};
+
+static const size_t WRITE_CHUNK_CLASS = 1;
+static const size_t WRITE_CHUNK_SIZE = InfraBufferPool::classSize( WRITE_CHUNK_CLASS );
+
+class StreamInteface : public InfraLoopTask {
   public:
+    Handle h = 0;
     uv_stream_t* stream;
+    ZeroWriteBatch* pending = nullptr;//see TcpZeroSocket::write()
+    LoopContainer* scheduledOn = nullptr;//while pending is to be flushed
+    unsigned writing = 0;//uv_write()'s in flight
 
-    std::function< void( void ) > onConnected;
-    std::function< void( const NetworkBuffer* ) > onRead;
-    std::function< void( void ) > onClosed;
-    std::function< void( void ) > onError;
+    InlineFunction< void( void ) > onConnected;
+    InlineFunction< void( const NetworkBuffer* ) > onRead;
+    //status: 0 if the peer has closed the connection, libuv error otherwise
+    //  NB: large enough to hold ClosedNoStatus (or the caller's InlineFunction< void( int ) >) in-place
+    InlineFunction< void( int ), sizeof( InlineFunction< void( void ) > ) > onClosed;
+    InlineFunction< void( void ) > onError;
 
     StreamInteface() {
         onConnected = []() {};
         onRead = []( const NetworkBuffer* ) {};
-        onClosed = []() {};
+        onClosed = []( int ) {};
         onError = []() {};
         stream = nullptr;
     }
+
+    void infraRunLoopTask() override;
+    void flush();
 };
 
 class SocketMap {
@@ -56,7 +89,9 @@ public:
 
 StreamInteface* SocketMap::add( TcpZeroSocket* s ) {
     s->h = nextHandle();
-    return &data.insert( std::map< Handle, StreamInteface >::value_type( s->h, StreamInteface() ) ).first->second;
+    StreamInteface* sint = &data.insert( std::map< Handle, StreamInteface >::value_type( s->h, StreamInteface() ) ).first->second;
+    sint->h = s->h;
+    return sint;
 }
 
 StreamInteface* SocketMap::find( Handle h ) {
@@ -77,24 +112,42 @@ uv_stream_t* SocketMap::remove( Handle h ) {
 
 static SocketMap sockets;
 
-void TcpZeroSocket::on( int eventId, std::function< void( const NetworkBuffer* ) > fn ) const {
+void TcpZeroSocket::on( int eventId, InlineFunction< void( const NetworkBuffer* ) > fn ) const {
     auto sint = sockets.find( h );
     AASSERT4( sint );
     if( ID_DATA == eventId )
-        sint->onRead = fn;
+        sint->onRead = std::move( fn );
+    else
+        AASSERT4( false );
+}
+
+//ID_CLOSED handler which doesn't care why
+struct ClosedNoStatus {
+    InlineFunction< void( void ) > fn;
+
+    void operator()( int ) const {
+        fn();
+    }
+};
+
+void TcpZeroSocket::on( int eventId, InlineFunction< void( int ) > fn ) const {
+    auto sint = sockets.find( h );
+    AASSERT4( sint );
+    if( ID_CLOSED == eventId )
+        sint->onClosed = std::move( fn );
     else
         AASSERT4( false );
 }
 
-void TcpZeroSocket::on( int eventId, std::function< void( void ) > fn ) const {
+void TcpZeroSocket::on( int eventId, InlineFunction< void( void ) > fn ) const {
     auto sint = sockets.find( h );
     AASSERT4( sint );
     if( ID_CLOSED == eventId )
-        sint->onClosed = fn;
+        sint->onClosed = ClosedNoStatus{ std::move( fn ) };
     else if( ID_ERROR == eventId )
-        sint->onError = fn;
+        sint->onError = std::move( fn );
     else if( ID_CONNECT == eventId )
-        sint->onConnected = fn;
+        sint->onConnected = std::move( fn );
     else
         AASSERT4( false );
 }
@@ -112,8 +165,8 @@ static inline uv_handle_t* uv_stream_to_handle( uv_stream_t* t ) {
 }
 
 struct ZeroQBuffer {
-    NetworkBuffer b;
     StreamInteface* sint;
+    size_t recvClass = 0;//of the next receive buffer, see InfraBufferPool::classFor()
 };
 
 struct ZeroQConnect {
@@ -134,27 +187,153 @@ static void tcpCloseCb( uv_handle_t* handle ) {
     delete reinterpret_cast<uv_tcp_t*>( handle );
 }
 
-static void allocCb( uv_handle_t* handle, size_t size, uv_buf_t* buff ) {
-    buff->len = size;
-    buff->base = new char[size];
+static InfraBufferPool& recvBuffers( uv_loop_t* loop ) {
+    return static_cast<LoopContainer*>( loop->data )->infraRecvBuffers();
+}
+
+//NB: libuv always suggests 64K; we go by how much the stream has been reading instead
+static void allocCb( uv_handle_t* handle, size_t /*suggested*/, uv_buf_t* buff ) {
+    auto item = static_cast<ZeroQBuffer*>( handle->data );
+    size_t cls = item ? item->recvClass : 0;
+    buff->base = recvBuffers( handle->loop ).allocate( cls );
+    buff->len = InfraBufferPool::classSize( cls );
 }
 
 static void readCb( uv_stream_t* stream, ssize_t nread, const uv_buf_t* buff ) {
     auto item = static_cast<ZeroQBuffer*>( stream->data );
     if( nread < 0 ) {
-        item->sint->onClosed();
+        item->sint->onClosed( nread == UV_EOF ? 0 : static_cast< int >( nread ) );
         uv_close( uv_stream_to_handle( stream ), tcpCloseCb );
+        item->sint->stream = nullptr;
         delete item;
         stream->data = nullptr;
+    } else if( nread > 0 ) {
+        item->recvClass = InfraBufferPool::classFor( nread, buff->len );
+        buff->base[nread] = '\0';
+        NetworkBuffer b( buff->base, nread );//NB: takes over our reference, handlers keep copies if they need the bytes later
+        item->sint->onRead( &b );
+        return;
+    }
+    InfraBufferPool::release( buff->base );
+}
+
+struct ZeroWriteBatches {
+    static const int MAX_FREE = 64;
+
+    ZeroWriteBatch* free = nullptr;
+    int freeCount = 0;
+
+    ~ZeroWriteBatches() {
+        while( free ) {
+            ZeroWriteBatch* b = free;
+            free = b->nextFree;
+            delete b;
+        }
+    }
+};
+static thread_local ZeroWriteBatches writeBatches;
+static thread_local ZeroWriteStats writeStats;
+
+const ZeroWriteStats& net::writeStats() {
+    return autom::writeStats;
+}
+
+static ZeroWriteBatch* takeBatch( Handle h ) {
+    ZeroWriteBatch* b = writeBatches.free;
+    if( b ) {
+        writeBatches.free = b->nextFree;
+        --writeBatches.freeCount;
+    } else {
+        b = new ZeroWriteBatch;
+    }
+    b->h = h;
+    return b;
+}
+
+static void releaseRef( const ZeroWriteRef& r ) {
+    InfraBufferPool::release( r.pooled );
+    delete r.payload;
+}
+
+static void releaseBatch( ZeroWriteBatch* b ) {
+    for( const auto& r : b->refs )
+        releaseRef( r );
+    //NB: keeping the capacity of the vectors, so that reused batches don't allocate
+    b->refs.clear();
+    b->bufs.clear();
+    if( writeBatches.freeCount < ZeroWriteBatches::MAX_FREE ) {
+        b->nextFree = writeBatches.free;
+        writeBatches.free = b;
+        ++writeBatches.freeCount;
     } else {
-        item->b.assign( buff->base, nread );
-        item->sint->onRead( &item->b );
+        delete b;
+    }
+}
+
+//Drops the first n bytes of b (written already), releasing the bufs which are over
+static void consumeBatch( ZeroWriteBatch* b, size_t n ) {
+    size_t i = 0;
+    while( i < b->bufs.size() && n >= b->bufs[i].len ) {
+        n -= b->bufs[i].len;
+        releaseRef( b->refs[i] );
+        ++i;
+    }
+    b->refs.erase( b->refs.begin(), b->refs.begin() + i );
+    b->bufs.erase( b->bufs.begin(), b->bufs.begin() + i );
+    if( n ) {
+        b->bufs[0].base += n;
+        b->bufs[0].len -= n;
     }
-    delete[] buff->base;
 }
 
 static void writeCb( uv_write_t* wr, int status ) {
-    delete wr;
+    auto b = static_cast<ZeroWriteBatch*>( wr->data );
+    auto sint = sockets.find( b->h );
+    if( sint ) {
+        AASSERT4( sint->writing > 0 );
+        --sint->writing;
+    }
+    releaseBatch( b );
+}
+
+void StreamInteface::infraRunLoopTask() {
+    scheduledOn = nullptr;
+    flush();
+}
+
+//Writes everything gathered by TcpZeroSocket::write() with a single writev(): right away if the socket takes it all
+//  (uv_try_write(), no request needed), otherwise whatever is left goes to uv_write()
+void StreamInteface::flush() {
+    ZeroWriteBatch* b = pending;
+    pending = nullptr;
+    if( !b )
+        return;
+    if( !stream ) {
+        releaseBatch( b );
+        return;
+    }
+    ++writeStats.flushes;
+    for( const auto& buf : b->bufs )
+        writeStats.bytes += buf.len;
+#ifndef AZERONET_NO_TRY_WRITE
+    //NB: not while earlier writes are in flight, as they MUST go first
+    if( !writing ) {
+        int n = uv_try_write( stream, b->bufs.data(), static_cast< unsigned >( b->bufs.size() ) );
+        if( n > 0 )
+            consumeBatch( b, n );
+        if( b->bufs.empty() ) {
+            ++writeStats.tryWritten;
+            releaseBatch( b );
+            return;
+        }
+        if( n > 0 )
+            ++writeStats.partial;
+    }
+#endif
+    ++writing;
+    ++writeStats.uvWrites;
+    b->req.data = b;
+    uv_write( &b->req, stream, b->bufs.data(), static_cast< unsigned >( b->bufs.size() ), writeCb );
 }
 
 void TcpZeroSocket::read() const {
@@ -168,20 +347,108 @@ void TcpZeroSocket::read() const {
     uv_read_start( item->sint->stream, allocCb, readCb );
 }
 
+void TcpZeroSocket::pauseRead() const {
+    auto sint = sockets.find( h );
+    if( !sint || !sint->stream )
+        return;
+    uv_read_stop( sint->stream );
+}
+
+void TcpZeroSocket::resumeRead() const {
+    auto sint = sockets.find( h );
+    if( !sint || !sint->stream || !sint->stream->data )
+        return;
+    uv_read_start( sint->stream, allocCb, readCb );
+}
+
+//Batch of the socket, which is flushed once the loop is done with the current callbacks (see StreamInteface::flush())
+//  so that a handler writing many pieces costs a single syscall
+static ZeroWriteBatch* pendingBatch( StreamInteface* sint ) {
+    if( !sint->pending ) {
+        auto loop = static_cast<LoopContainer*>( sint->stream->loop->data );
+        sint->pending = takeBatch( sint->h );
+        sint->scheduledOn = loop;
+        loop->infraSchedule( sint );
+    }
+    return sint->pending;
+}
+
+//Copies buff to the batch of the socket; no allocations once pools are warm
 void TcpZeroSocket::write( const void* buff, size_t sz ) const {
     auto sint = sockets.find( h );
     AASSERT4( sint );
-    if( !sint )
+    //NB: stream is gone once the socket is closed by the peer (see readCb()), and there is nobody to write to
+    if( !sint || !sint->stream || !sz )
+        return;
+    auto& pool = static_cast<LoopContainer*>( sint->stream->loop->data )->infraWriteBuffers();
+    ZeroWriteBatch* b = pendingBatch( sint );
+    auto src = static_cast<const char*>( buff );
+    while( sz ) {
+        if( b->bufs.empty() || !b->refs.back().chunk || b->bufs.back().len == WRITE_CHUNK_SIZE ) {
+            char* c = pool.allocate( WRITE_CHUNK_CLASS );
+            b->refs.push_back( ZeroWriteRef{ c, nullptr, true } );
+            b->bufs.push_back( uv_buf_init( c, 0 ) );
+        }
+        uv_buf_t& last = b->bufs.back();
+        size_t n = WRITE_CHUNK_SIZE - last.len;
+        if( n > sz )
+            n = sz;
+        memcpy( last.base + last.len, src, n );
+        last.len += n;
+        src += n;
+        sz -= n;
+    }
+}
+
+//Large payload goes to the batch as it is (small one is copied, as a chunk is cheaper than holding it)
+void TcpZeroSocket::write( std::string&& payload ) const {
+    if( payload.size() < WRITE_CHUNK_SIZE ) {
+        write( payload.data(), payload.size() );
+        return;
+    }
+    auto sint = sockets.find( h );
+    AASSERT4( sint );
+    if( !sint || !sint->stream )
         return;
-    uv_write_t* wr = new uv_write_t;
-    uv_buf_t b = uv_buf_init( ( char* )buff, sz );
-    uv_write( wr, sint->stream, &b, 1, writeCb );
+    ZeroWriteBatch* b = pendingBatch( sint );
+    auto s = new std::string( std::move( payload ) );
+    b->refs.push_back( ZeroWriteRef{ nullptr, s, false } );
+    b->bufs.push_back( uv_buf_init( const_cast<char*>( s->data() ), static_cast< unsigned >( s->size() ) ) );
+    writeStats.referenced += s->size();
+}
+
+//Shares the bytes of buff, same as large payloads
+void TcpZeroSocket::write( const NetworkBuffer& buff ) const {
+    if( buff.size() < WRITE_CHUNK_SIZE ) {
+        write( buff.data(), buff.size() );
+        return;
+    }
+    auto sint = sockets.find( h );
+    AASSERT4( sint );
+    if( !sint || !sint->stream )
+        return;
+    ZeroWriteBatch* b = pendingBatch( sint );
+    InfraBufferPool::addRef( buff.data() );
+    b->refs.push_back( ZeroWriteRef{ buff.data(), nullptr, false } );
+    b->bufs.push_back( uv_buf_init( const_cast<char*>( buff.data() ), static_cast< unsigned >( buff.size() ) ) );
+    writeStats.referenced += buff.size();
 }
 
 void TcpZeroSocket::close() const {
+    auto sint = sockets.find( h );
+    if( !sint )
+        return;
+    //NB: what has been written so far goes before the close
+    if( sint->scheduledOn ) {
+        sint->scheduledOn->infraUnschedule( sint );
+        sint->scheduledOn = nullptr;
+    }
+    sint->flush();
     auto stream = sockets.remove( h );
     if( !stream )
         return;
+    delete static_cast<ZeroQBuffer*>( stream->data );//NB: no more readCb's once it is closed
+    stream->data = nullptr;
     uv_close( uv_stream_to_handle( stream ), tcpCloseCb );
 }
 
@@ -190,8 +457,8 @@ class ListenerInterface {
     uv_tcp_t* listenerTcp;
     LoopContainer* loop;
 
-    std::function< void( TcpZeroSocket ) > onConnect;
-    std::function< void( void ) > onError;
+    InlineFunction< void( TcpZeroSocket ) > onConnect;
+    InlineFunction< void( void ) > onError;
 
     explicit ListenerInterface( LoopContainer* loop_ ) {
         loop = loop_;
@@ -231,6 +498,7 @@ static ListenerMap servers;
 static void acceptCb( uv_stream_t* server, int status ) {
     auto serverConn = new uv_tcp_t;
     uv_tcp_init( server->loop, serverConn );
+    serverConn->data = nullptr;//NB: uv_tcp_init() leaves it as it is, and close() deletes it, whether read() has been called or not
     if( uv_accept( server, uv_tcp_to_stream( serverConn ) ) == 0 ) {
         AASSERT4( server->data );
         auto item = static_cast<ZeroQAccept*>( server->data );
@@ -250,18 +518,18 @@ TcpZeroServer::TcpZeroServer( LoopContainer* loop_ ) {
     servers.add( this, loop_ );
 }
 
-void TcpZeroServer::on( int eventId, std::function< void( TcpZeroSocket ) > fn ) {
+void TcpZeroServer::on( int eventId, InlineFunction< void( TcpZeroSocket ) > fn ) {
     auto sint = servers.find( h );
     if( TcpZeroServer::ID_CONNECT == eventId )
-        sint->onConnect = fn;
+        sint->onConnect = std::move( fn );
     else
         AASSERT4( 0 );
 }
 
-void TcpZeroServer::on( int eventId, std::function< void( void ) > fn ) {
+void TcpZeroServer::on( int eventId, InlineFunction< void( void ) > fn ) {
     auto sint = servers.find( h );
     if( TcpZeroServer::ID_ERROR == eventId )
-        sint->onError = fn;
+        sint->onError = std::move( fn );
     else
         AASSERT4( 0 );
 }
@@ -282,9 +550,36 @@ bool TcpZeroServer::listen( int port ) {
         }
     }
     uv_close( uv_tcp_to_handle( sint->listenerTcp ), tcpCloseCb );
+    sint->listenerTcp = nullptr;
     return false;
 }
 
+int TcpZeroServer::port() const {
+    auto sint = servers.find( h );
+    if( !sint || !sint->listenerTcp )
+        return 0;
+    sockaddr_in addr;
+    int len = sizeof( addr );
+    if( 0 != uv_tcp_getsockname( sint->listenerTcp, ( sockaddr* )&addr, &len ) )
+        return 0;
+    return ntohs( addr.sin_port );
+}
+
+static void listenerCloseCb( uv_handle_t* handle ) {
+    delete static_cast<ZeroQAccept*>( handle->data );
+    delete reinterpret_cast<uv_tcp_t*>( handle );
+}
+
+//Stops accepting connections; the ones accepted so far are not affected
+void TcpZeroServer::close() {
+    auto sint = servers.find( h );
+    if( !sint )
+        return;
+    if( sint->listenerTcp )
+        uv_close( uv_tcp_to_handle( sint->listenerTcp ), listenerCloseCb );
+    servers.remove( h );
+}
+
 static void tcpConnectedCb( uv_connect_t* req, int status ) {
     auto sint = static_cast<ZeroQConnect*>( req->data );
     if( status >= 0 ) {
@@ -301,6 +596,7 @@ static void tcpConnectedCb( uv_connect_t* req, int status ) {
 TcpZeroSocket net::connect( LoopContainer* loop, const char* addr, int port ) {
     auto client = new uv_tcp_t;
     uv_tcp_init( loop->infraLoop(), client );
+    client->data = nullptr;//NB: see acceptCb()
     sockaddr_in ip;
     uv_ip4_addr( addr, port, &ip );
     uv_connect_t* req = new uv_connect_t;
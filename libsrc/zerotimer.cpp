@@ -25,14 +25,18 @@ class ZeroTimer {
         onTime = []() {};
     }
 
-    std::function< void( void ) > onTime;
+    InlineFunction< void( void ) > onTime;
 };
 
 struct ZeroQTimer {
     ZeroTimer* zt;
+    bool cancellable = false;//closed by cancelTimeout() rather than right after it fires
 };
 
 static void timerCloseCb( uv_handle_t* handle ) {
+    auto item = static_cast<ZeroQTimer*>( handle->data );
+    delete item->zt;
+    delete item;
     delete ( uv_timer_t* )handle;
 }
 
@@ -40,19 +44,16 @@ static void timerCb( uv_timer_t* handle ) {
     AASSERT4( handle->data );
     auto item = static_cast<const ZeroQTimer*>( handle->data );
     item->zt->onTime();
-    if( !uv_timer_get_repeat( handle ) ) {
-        handle->data = nullptr;
+    if( !uv_timer_get_repeat( handle ) && !item->cancellable )
         uv_close( ( uv_handle_t* )handle, timerCloseCb );
-        delete item;
-    }
 }
 
-void setInterval( LoopContainer* loop, std::function< void( void ) > fn, unsigned secRepeat ) {
+void setInterval( LoopContainer* loop, InlineFunction< void( void ) > fn, unsigned secRepeat ) {
     AASSERT4( secRepeat > 0 );
 
     auto item = new ZeroQTimer;
     auto zt = new ZeroTimer;
-    zt->onTime = fn;
+    zt->onTime = std::move( fn );
     item->zt = zt;
 
     uv_timer_t* timer = new uv_timer_t;
@@ -61,16 +62,40 @@ void setInterval( LoopContainer* loop, std::function< void( void ) > fn, unsigne
     uv_timer_start( timer, timerCb, secRepeat * 1000, secRepeat * 1000 );
 }
 
-void startTimeout( LoopContainer* loop, std::function< void( void ) > fn, unsigned secDelay ) {
+void startTimeout( LoopContainer* loop, InlineFunction< void( void ) > fn, unsigned secDelay ) {
+    startTimeoutMs( loop, std::move( fn ), secDelay * 1000 );
+}
+
+static uv_timer_t* startTimer( LoopContainer* loop, InlineFunction< void( void ) > fn, unsigned msDelay, bool cancellable ) {
     auto item = new ZeroQTimer;
     auto zt = new ZeroTimer;
-    zt->onTime = fn;
+    zt->onTime = std::move( fn );
     item->zt = zt;
+    item->cancellable = cancellable;
 
     uv_timer_t* timer = new uv_timer_t;
     timer->data = item;
     uv_timer_init( loop->infraLoop(), timer );
-    uv_timer_start( timer, timerCb, secDelay * 1000, 0 );
+    uv_timer_start( timer, timerCb, msDelay, 0 );
+    return timer;
+}
+
+void startTimeoutMs( LoopContainer* loop, InlineFunction< void( void ) > fn, unsigned msDelay ) {
+    startTimer( loop, std::move( fn ), msDelay, false );
+}
+
+ZeroTimeout startCancellableTimeoutMs( LoopContainer* loop, InlineFunction< void( void ) > fn, unsigned msDelay ) {
+    ZeroTimeout ret;
+    ret.timer = startTimer( loop, std::move( fn ), msDelay, true );
+    return ret;
+}
+
+void cancelTimeout( ZeroTimeout& timeout ) {
+    AASSERT4( timeout.timer, "cancelTimeout(): no timeout, or released already" );
+    auto timer = static_cast<uv_timer_t*>( timeout.timer );
+    uv_timer_stop( timer );//NB: no-op if it has fired already
+    uv_close( ( uv_handle_t* )timer, timerCloseCb );
+    timeout.timer = nullptr;
 }
 
 }
\ No newline at end of file
@@ -1,5 +1,7 @@
 #include <exception>
 #include <iostream>
+#include <memory>
+#include <stdexcept>
 
 #include "../include/aassert.h"
 #include "../include/aconsole.h"
@@ -13,6 +15,9 @@
 #include "../libsrc/infra/nodecontainer.h"
 #include "../libsrc/infra/loopcontainer.h"
 #include "../include/ccode.h"
+#include "../include/cflat.h"
+#include "../include/cstatic.h"
+#include "../include/acoro.h"
 
 using namespace std;
 using namespace autom;
@@ -299,6 +304,234 @@ class NodeServer5 : public Node {
     }
 };
 
+//One CCodeProgram, built on first use and then started for each "connection"
+struct NodeServer9Conn {
+    Node* node;
+    int id;
+    unsigned delay;
+    int n = 0;
+    Future<Timer> t;
+    Future<bool> more;
+
+    NodeServer9Conn( Node* node_, int id_, unsigned delay_ ) : node( node_ ), id( id_ ), delay( delay_ ), more( node_ ) {}
+};
+
+class NodeServer9 : public Node {
+    using Conn = NodeServer9Conn;
+    using Program = CCodeProgram<Conn>;
+
+    static const Program& connProgram() {
+        static const Program program(
+        []( Conn & c ) {
+            c.more.setValue( true );
+        },
+        Program::wwhile( &Conn::more,
+        []( Conn & c ) {
+            c.t = startTimeout( c.node, c.delay );
+        },
+        Program::waitFor( &Conn::t ),
+        []( Conn & c ) {
+            infraConsole.log( "conn {}: tick {}", c.id, ++c.n );
+            c.more.setValue( c.n < 2 );
+        } ),
+        Program::ttry(
+        []( Conn & c ) {
+            if( c.id == 2 )
+                throw std::runtime_error( "conn 2 failed" );
+        } ).ccatch( []( Conn & c, const std::exception & x ) {
+            infraConsole.log( "conn {}: caught '{}'", c.id, x.what() );
+        } ),
+        []( Conn & c ) {
+            infraConsole.log( "conn {}: done", c.id );
+        } );
+        return program;
+    }
+
+  public:
+    void run() override {
+        connProgram().start( this, 1, 3 );
+        connProgram().start( this, 2, 5 );
+        connProgram().start( this, 3, 4 );
+    }
+};
+
+//The same program as benchProgramCCode(), run by CFlatCode
+#undef ACCODE_ENGINE
+#define ACCODE_ENGINE CFlatCode
+static void benchProgramFlat( const Future<bool>& cond, int* sum ) {
+    CCODE {
+        ( *sum )++;
+        IIF( cond ) {
+            ( *sum )++;
+        }
+        EELSE {
+            throw std::runtime_error( "never" );
+        }
+        ENDIIF
+        TTRY {
+            ( *sum )++;
+        }
+        CCATCH( const std::exception & x ) {
+            ( *sum ) -= 1000;
+        }
+        ENDTTRY
+        ( *sum )++;
+        ( *sum )++;
+    }
+    ENDCCODE
+}
+#undef ACCODE_ENGINE
+#define ACCODE_ENGINE CCode
+
+//Independent timers awaited at once, and concurrent branches
+class NodeServer11 : public Node {
+  public:
+    void run() override {
+        Future<Timer> data1( this ), data2( this ), data3( this ), data4( this ), data5( this ), data6( this ), data7( this ), data8( this ), data9( this );
+        CCODE {
+            startTimeout( data1, this, 15 );
+            startTimeout( data2, this, 6 );
+            startTimeout( data3, this, 5 );
+            infraConsole.log( "timers 1, 2 and 3 started" );
+            AWAIT_ALL( data1, data2, data3 );
+            infraConsole.log( "timers 1, 2 and 3 are over" );
+            PPARALLEL {
+                startTimeout( data4, this, 4 );
+                AWAIT( data4 );
+                infraConsole.log( "branch A: timer 4" );
+            }
+            AAND {
+                infraConsole.log( "branch B: nothing to wait for" );
+            }
+            AAND {
+                startTimeout( data5, this, 2 );
+                AWAIT( data5 );
+                infraConsole.log( "branch C: timer 5" );
+            }
+            ENDPPARALLEL
+            infraConsole.log( "branches A, B and C are over" );
+            TTRY {
+                PPARALLEL {
+                    startTimeout( data6, this, 7 );
+                    AWAIT( data6 );
+                    infraConsole.log( "branch D: timer 6" );
+                }
+                AAND {
+                    startTimeout( data7, this, 3 );
+                    AWAIT( data7 );
+                    throw std::runtime_error( "branch E failed" );
+                }
+                ENDPPARALLEL
+                infraConsole.log( "NOT REACHED" );
+            }
+            CCATCH( const std::exception & x ) {
+                infraConsole.log( "caught '{}'", x.what() );
+            }
+            ENDTTRY
+            startTimeout( data8, this, 9 );
+            startTimeout( data9, this, 1 );
+            AWAIT_ANY( data8, data9 );
+            infraConsole.log( "one of timers 8 and 9 is over" );
+        }
+        ENDCCODE
+    }
+};
+
+static const ErrorStatus giveUp( ErrorStatus::USER, "giving up" );
+
+class NodeServer12 : public Node {
+    CancelToken token;
+
+  public:
+    void run() override {
+        Future<Timer> data1( this ), data2( this );
+        CCODE {
+            startTimeout( data1, this, 5 );
+            TTRY {
+                AWAIT_FOR( data1, 1000 );
+                infraConsole.log( "NOT REACHED" );
+            }
+            CCATCH( const std::exception & x ) {
+                infraConsole.log( "timer 1: caught '{}' (code {})", x.what(), errorCode( x ) );
+            }
+            ENDTTRY
+            startTimeout( data2, this, 1 );
+            TTRY {
+                AWAIT_FOR( data2, 3000 );
+                infraConsole.log( "timer 2 is in time" );
+                CCode::fail( giveUp );//NB: nothing is thrown, the step just goes to CCATCH once it is over
+            }
+            CCATCH( const std::exception & x ) {
+                infraConsole.log( "timer 2: caught '{}' (code {})", x.what(), errorCode( x ) );
+            }
+            ENDTTRY
+        }
+        ENDCCODE
+
+        startStuck();
+        startCanceller();
+    }
+
+  private:
+    void startStuck() {
+        Future<Timer> data3( this ), data4( this );
+        CCODE_WITH( token ) {
+            startTimeout( data3, this, 4 );
+            startTimeout( data4, this, 4 );
+            infraConsole.log( "waiting for timers 3 and 4, which are too slow" );
+            PPARALLEL {
+                AWAIT( data3 );
+                infraConsole.log( "NOT REACHED" );
+            }
+            AAND {
+                AWAIT( data4 );
+                infraConsole.log( "NOT REACHED" );
+            }
+            ENDPPARALLEL
+            infraConsole.log( "NOT REACHED" );
+        }
+        ENDCCODE
+    }
+    void startCanceller() {
+        Future<Timer> data5( this );
+        CCODE {
+            startTimeout( data5, this, 2 );
+            AWAIT( data5 );
+            infraConsole.log( "timer 5: cancelling timers 3 and 4" );
+            token.cancel();
+        }
+        ENDCCODE
+    }
+};
+
+//The same program as benchProgramCCode(), run by CStaticCode
+#undef ACCODE_ENGINE
+#define ACCODE_ENGINE CStaticCode
+static void benchProgramStatic( const Future<bool>& cond, int* sum ) {
+    CCODE {
+        ( *sum )++;
+        IIF( cond ) {
+            ( *sum )++;
+        }
+        EELSE {
+            throw std::runtime_error( "never" );
+        }
+        ENDIIF
+        TTRY {
+            ( *sum )++;
+        }
+        CCATCH( const std::exception & x ) {
+            ( *sum ) -= 1000;
+        }
+        ENDTTRY
+        ( *sum )++;
+        ( *sum )++;
+    }
+    ENDCCODE
+}
+#undef ACCODE_ENGINE
+#define ACCODE_ENGINE CCode
+
 class ZeroServer0 {
   public:
     void run( LoopContainer& loop ) {
@@ -409,6 +642,1497 @@ class NodeClient0 : public Node {
     }
 };
 
+class NodeBench : public Node {
+  public:
+    void run() override {}
+};
+
+//Cost of Future<> copy/then()/value(); compare builds with -DAASSERT_LVL=5 (FutureId verification) and without
+static void benchFuture() {
+    const int N = 10000000;
+    NodeBench node;
+    Future< int > f( &node );
+    f.setValue( 1 );
+    int sum = 0;
+    console.log( "benchFuture: AASSERT_LVL {}, {} iterations", AASSERT_LVL, N );
+
+    auto label = console.timeWithLabel();
+    for( int i = 0; i < N; i++ ) {
+        Future< int > copy( f );
+    }
+    console.timeEnd( label, "Future copy" );
+
+    label = console.timeWithLabel();
+    for( int i = 0; i < N; i++ ) {
+        sum += f.value();
+    }
+    console.timeEnd( label, "Future value()" );
+    console.log( "sum {}", sum );
+
+    label = console.timeWithLabel();
+    for( int i = 0; i < N; i++ ) {
+        f.then( [ = ]( const std::exception * ) {} );
+    }
+    console.timeEnd( label, "Future then()" );
+}
+
+static void benchProgramCCode( const Future<bool>& cond, int* sum ) {
+    CCODE {
+        ( *sum )++;
+        IIF( cond ) {
+            ( *sum )++;
+        }
+        EELSE {
+            throw std::runtime_error( "never" );
+        }
+        ENDIIF
+        TTRY {
+            ( *sum )++;
+        }
+        CCATCH( const std::exception & x ) {
+            ( *sum ) -= 1000;
+        }
+        ENDTTRY
+        ( *sum )++;
+        ( *sum )++;
+    }
+    ENDCCODE
+}
+
+struct BenchFrame {
+    Future<bool> cond;
+    int* sum;
+
+    BenchFrame( const Future<bool>& cond_, int* sum_ ) : cond( cond_ ), sum( sum_ ) {}
+};
+using BenchProgram = CCodeProgram<BenchFrame>;
+
+//The same program as benchProgramCCode(), built once
+static const BenchProgram& benchProgram() {
+    static const BenchProgram program(
+    []( BenchFrame & f ) {
+        ( *f.sum )++;
+    },
+    BenchProgram::iif( &BenchFrame::cond,
+    []( BenchFrame & f ) {
+        ( *f.sum )++;
+    } ).eelse(
+    []( BenchFrame & f ) {
+        throw std::runtime_error( "never" );
+    } ),
+    BenchProgram::ttry(
+    []( BenchFrame & f ) {
+        ( *f.sum )++;
+    } ).ccatch( []( BenchFrame & f, const std::exception & x ) {
+        ( *f.sum ) -= 1000;
+    } ),
+    []( BenchFrame & f ) {
+        ( *f.sum )++;
+    },
+    []( BenchFrame & f ) {
+        ( *f.sum )++;
+    } );
+    return program;
+}
+
+//Cost of building and running a short program (no waits) on CCode vs CFlatCode vs CStaticCode, and of starting it as CCodeProgram
+static void benchCCode() {
+    const int N = 1000000;
+    NodeBench node;
+    Future< bool > cond( &node );
+    cond.setValue( true );
+    int sum = 0;
+    console.log( "benchCCode: {} programs", N );
+
+    AStepArena::Stats arena = AStepArena::stats();
+    auto label = console.timeWithLabel();
+    for( int i = 0; i < N; i++ )
+        benchProgramCCode( cond, &sum );
+    console.timeEnd( label, "CCode" );
+    console.log( "sum {}", sum );
+    console.log( "CCode steps: {} programs, {} steps, {} global heap allocations", AStepArena::stats().programs - arena.programs,
+                 AStepArena::stats().steps - arena.steps, AStepArena::stats().heapAllocs - arena.heapAllocs );
+
+    sum = 0;
+    label = console.timeWithLabel();
+    for( int i = 0; i < N; i++ )
+        benchProgramFlat( cond, &sum );
+    console.timeEnd( label, "CFlatCode" );
+    console.log( "sum {}", sum );
+
+    sum = 0;
+    label = console.timeWithLabel();
+    for( int i = 0; i < N; i++ )
+        benchProgramStatic( cond, &sum );
+    console.timeEnd( label, "CStaticCode" );
+    console.log( "sum {}", sum );
+
+    sum = 0;
+    label = console.timeWithLabel();
+    for( int i = 0; i < N; i++ )
+        benchProgram().start( cond, &sum );
+    console.timeEnd( label, "CCodeProgram::start()" );
+    console.log( "sum {}", sum );
+}
+
+//NB: a functor rather than a lambda, so that all the steps of a body are of the same type (keeps instantiations down)
+struct BenchLoopStep {
+    int* sum;
+
+    explicit BenchLoopStep( int* sum_ ) : sum( sum_ ) {}
+    void operator()() const {
+        ( *sum )++;
+    }
+};
+
+//Runs WWHILE( cond ) over a body of N steps on Engine; the last step stops the loop once *sum reaches total
+template< typename Engine, int N >
+struct BenchLoopBody {
+    template< typename... Ts >
+    static void run( const Future<bool>& cond, int* sum, int total, Ts&& ... steps ) {
+        BenchLoopBody < Engine, N - 1 >::run( cond, sum, total, BenchLoopStep( sum ), std::forward< Ts >( steps )... );
+    }
+};
+
+template< typename Engine >
+struct BenchLoopBody< Engine, 1 > {
+    template< typename... Ts >
+    static void run( const Future<bool>& cond, int* sum, int total, Ts&& ... steps ) {
+        Engine code( Engine::wwhile( cond, std::forward< Ts >( steps )..., [ = ]() {
+            if( ++( *sum ) >= total )
+                cond.setValue( false );
+        } ) );
+    }
+};
+
+template< typename Engine, int N >
+static void benchLoop( const char* engine ) {
+    const int ITERATIONS = 10000000 / N;
+    NodeBench node;
+    Future< bool > cond( &node );
+    cond.setValue( true );
+    int sum = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    BenchLoopBody< Engine, N >::run( cond, &sum, ITERATIONS * N );
+    std::chrono::duration< double > elapsed = std::chrono::steady_clock::now() - start;
+    console.log( "{}: WWHILE body of {} steps: {} iterations/sec", engine, N, ( long long )( ITERATIONS / elapsed.count() ) );
+    AASSERT4( sum == ITERATIONS * N );
+}
+
+//Cost of a WWHILE iteration depending on the size of the loop body
+static void benchWhile() {
+    benchLoop< CCode, 1 >( "CCode" );
+    benchLoop< CCode, 10 >( "CCode" );
+    benchLoop< CCode, 100 >( "CCode" );
+    benchLoop< CFlatCode, 1 >( "CFlatCode" );
+    benchLoop< CFlatCode, 10 >( "CFlatCode" );
+    benchLoop< CFlatCode, 100 >( "CFlatCode" );
+    benchLoop< CStaticCode, 1 >( "CStaticCode" );
+    benchLoop< CStaticCode, 10 >( "CStaticCode" );
+    benchLoop< CStaticCode, 100 >( "CStaticCode" );
+}
+
+#ifdef ACORO_ENABLED
+//NodeServer3/4/5 programs without logging, on CCode and as coroutines; futures are completed by benchScenario()
+static void benchScenario3CCode( Node*, const Future<Timer>* d, int* sum ) {
+    Future<Timer> data1( d[0] ), data2( d[1] ), data3( d[2] );
+    CCODE {
+        TTRY {
+            ( *sum )++;
+            AWAIT( data1 );
+            ( *sum )++;
+            ( *sum )++;
+            AWAIT( data2 );
+            ( *sum )++;
+            ( *sum )++;
+            AWAIT( data3 );
+            ( *sum )++;
+            ( *sum )++;
+            ( *sum )++;
+        }
+        CCATCH( const std::exception & x ) {
+            ( *sum ) -= 1000;
+        }
+        ENDTTRY
+    }
+    ENDCCODE
+}
+
+static CoTask benchScenario3Coro( Node*, const Future<Timer>* d, int* sum ) {
+    Future<Timer> data1( d[0] ), data2( d[1] ), data3( d[2] );
+    try {
+        ( *sum )++;
+        co_await data1;
+        ( *sum )++;
+        ( *sum )++;
+        co_await data2;
+        ( *sum )++;
+        ( *sum )++;
+        co_await data3;
+        ( *sum )++;
+        ( *sum )++;
+        ( *sum )++;
+    } catch( const std::exception& x ) {
+        ( *sum ) -= 1000;
+    }
+}
+
+static void benchScenario4CCode( Node* node, const Future<Timer>* d, int* sum ) {
+    Future<Timer> data( d[0] ), data2( d[1] ), data3( d[2] );
+    Future<bool> cond( node );
+    CCODE {
+        TTRY {
+            AWAIT( data );
+            ( *sum )++;
+            cond.setValue( false );
+            IIF( cond ) {
+                ( *sum ) -= 1000;
+                AWAIT( data2 );
+                ( *sum ) -= 1000;
+            }
+            EELSE {
+                ( *sum )++;
+                AWAIT( data3 );
+                ( *sum )++;
+            }
+            ENDIIF
+            ( *sum )++;
+        }
+        CCATCH( const std::exception & x ) {
+            ( *sum ) -= 1000;
+        }
+        ENDTTRY
+    }
+    ENDCCODE
+}
+
+static CoTask benchScenario4Coro( Node*, const Future<Timer>* d, int* sum ) {
+    Future<Timer> data( d[0] ), data2( d[1] ), data3( d[2] );
+    try {
+        co_await data;
+        ( *sum )++;
+        bool cond = false;
+        if( cond ) {
+            ( *sum ) -= 1000;
+            co_await data2;
+            ( *sum ) -= 1000;
+        } else {
+            ( *sum )++;
+            co_await data3;
+            ( *sum )++;
+        }
+        ( *sum )++;
+    } catch( const std::exception& x ) {
+        ( *sum ) -= 1000;
+    }
+}
+
+static void benchScenario5CCode( Node* node, const Future<Timer>* d, int* sum ) {
+    Future<Timer> data( d[0] ), data2( d[1] ), data3( d[2] ), data4( d[3] ), data5( d[4] );
+    Future<bool> cond( node );
+    CCODE {
+        TTRY {
+            AWAIT( data );
+            ( *sum )++;
+            cond.setValue( true );
+            WWHILE( cond ) {
+                ( *sum )++;
+                if( *sum % 11 == 0 )
+                    cond.setValue( false );
+            }
+            ENDWWHILE
+            IIF( cond ) {
+                ( *sum ) -= 1000;
+                AWAIT( data2 );
+            }
+            EELSE {
+                TTRY {
+                    ( *sum )++;
+                    cond.setValue( true );
+                    AWAIT( data3 );
+                }
+                CCATCH( const std::exception & x ) {
+                    ( *sum ) -= 1000;
+                }
+                ENDTTRY
+                ( *sum )++;
+            }
+            ENDIIF
+            IIF( cond ) {
+                ( *sum )++;
+                AWAIT( data4 );
+                ( *sum )++;
+            }
+            EELSE {
+                ( *sum ) -= 1000;
+                AWAIT( data5 );
+            }
+            ENDIIF
+        }
+        CCATCH( const std::exception & x ) {
+            ( *sum ) -= 1000;
+        }
+        ENDTTRY
+    }
+    ENDCCODE
+}
+
+static CoTask benchScenario5Coro( Node*, const Future<Timer>* d, int* sum ) {
+    Future<Timer> data( d[0] ), data2( d[1] ), data3( d[2] ), data4( d[3] ), data5( d[4] );
+    try {
+        co_await data;
+        ( *sum )++;
+        bool cond = true;
+        while( cond ) {
+            ( *sum )++;
+            if( *sum % 11 == 0 )
+                cond = false;
+        }
+        if( cond ) {
+            ( *sum ) -= 1000;
+            co_await data2;
+        } else {
+            try {
+                ( *sum )++;
+                cond = true;
+                co_await data3;
+            } catch( const std::exception& x ) {
+                ( *sum ) -= 1000;
+            }
+            ( *sum )++;
+        }
+        if( cond ) {
+            ( *sum )++;
+            co_await data4;
+            ( *sum )++;
+        } else {
+            ( *sum ) -= 1000;
+            co_await data5;
+        }
+    } catch( const std::exception& x ) {
+        ( *sum ) -= 1000;
+    }
+}
+
+//Runs program N times; each time, its timers are completed in the given order, the way Node does it
+template< typename Program >
+static void benchScenario( const char* label, Program program, std::initializer_list< int > fireOrder ) {
+    const int N = 1000000;
+    NodeBench node;
+    int sum = 0;
+
+    auto t = console.timeWithLabel();
+    for( int i = 0; i < N; i++ ) {
+        Future<Timer> d[5] = { Future<Timer>( &node ), Future<Timer>( &node ), Future<Timer>( &node ), Future<Timer>( &node ), Future<Timer>( &node ) };
+        program( &node, d, &sum );
+        for( int k : fireOrder ) {
+            auto inf = d[k].infraGetPtr();
+            inf->setDataReady();
+            inf->infraFire( nullptr );
+            inf->cleanup();
+        }
+        node.futureCleanup();
+    }
+    console.timeEnd( t, label );
+    const auto& st = node.framePoolStats();
+    console.log( "sum {}, coroutine frames: hits {} misses {} in use {}", sum, st.hits, st.misses, st.inUse );
+}
+
+//CCode vs coroutines on NodeServer3/4/5 programs (NodeServer3 completes data3 first)
+static void benchCoro() {
+    console.log( "benchCoro: NodeServer3/4/5 programs" );
+    benchScenario( "NodeServer3 CCode", benchScenario3CCode, { 2, 0, 1 } );
+    benchScenario( "NodeServer3 coroutine", benchScenario3Coro, { 2, 0, 1 } );
+    benchScenario( "NodeServer4 CCode", benchScenario4CCode, { 0, 1, 2 } );
+    benchScenario( "NodeServer4 coroutine", benchScenario4Coro, { 0, 1, 2 } );
+    benchScenario( "NodeServer5 CCode", benchScenario5CCode, { 0, 1, 2, 3, 4 } );
+    benchScenario( "NodeServer5 coroutine", benchScenario5Coro, { 0, 1, 2, 3, 4 } );
+}
+#endif
+
+//CLOSED events keep their codes through Node's event queue (events are moved on each push and pop, and when the queue grows)
+static void testClosedEvent() {
+    const int codes[] = { ErrorStatus::CLOSED, ErrorStatus::RESET, ErrorStatus::CONNECT_FAILED };
+    InfraQueue< NodeQEvent > q;
+    for( int i = 0; i < 40; i++ ) {
+        NodeQClosed item;
+        item.id = i;
+        item.code = codes[i % 3];
+        q.push( NodeQEvent( item ) );
+    }
+    for( int i = 0; i < 40; i++ ) {
+        NodeQEvent ev = q.pop();
+        AASSERT4( ev.type == NODEQ::CLOSED );
+        AASSERT4( ev.closed.id == FutureId( i ) );
+        AASSERT4( ev.closed.code == codes[i % 3], "{}: code {}", i, ev.closed.code );
+        AASSERT4( errorCode( ErrorStatus::get( ev.closed.code ) ) == codes[i % 3] );
+    }
+    console.log( "testClosedEvent: OK" );
+}
+
+//Reads already queued when the producer is paused go past highWater instead of failing
+static void testBufferedOverflow() {
+    InfraBufferedFuture< int > f( 4, 1 );
+    int pauses = 0, resumes = 0;
+    f.flowControl = [ & ]( bool pause ) {
+        ( pause ? pauses : resumes )++;
+    };
+    for( int i = 0; i < 4 + 32; i++ )//highWater, then as many reads as libuv MAY deliver in one poll
+        f.push( int( i ) );
+    AASSERT4( pauses == 1 && resumes == 0 );
+    AASSERT4( f.size() == 36 );
+    for( int i = 0; i < 35; i++ )
+        AASSERT4( f.pop() == i );
+    AASSERT4( pauses == 1 && resumes == 1 );
+    for( int i = 0; i < 4; i++ )
+        f.push( int( 100 + i ) );
+    AASSERT4( pauses == 2 );
+    AASSERT4( f.pop() == 35 && f.pop() == 100 );
+    console.log( "testBufferedOverflow: OK" );
+}
+
+//Values pending when the source is closed are still there after Node has processed the CLOSED event,
+//  and the queue is reclaimed once the last BufferedMultiFuture is gone (including the one captured by onEach())
+static void testBufferedClosed() {
+    NodeBench node;
+    FutureId id;
+    int closes = 0;
+    int* pcloses = &closes;
+    {
+        BufferedMultiFuture< int > bf( &node, 4, 1 );
+        id = bf.infraGetId();
+        bf.onEach( [ = ]( const std::exception * ex ) {
+            if( ex )
+                ++*pcloses;
+            else
+                AASSERT4( !bf.empty() );
+        } );
+        auto inf = static_cast< InfraBufferedFuture< int >* >( node.findInfraFuture( id ) );
+        for( int i = 0; i < 3; i++ ) {
+            inf->push( int( i ) );
+            inf->setDataReady();
+            inf->infraFire( nullptr );
+            inf->cleanup();
+        }
+        inf->infraFire( &ErrorStatus::get( ErrorStatus::CLOSED ) );
+        inf->cleanupMulti();
+        node.futureCleanup();
+        AASSERT4( closes == 1 );
+        AASSERT4( node.findInfraFuture( id ) == inf );
+        BufferedMultiFuture< int > later( bf );
+        AASSERT4( later.size() == 3 && later.pop() == 0 && bf.pop() == 1 && later.front() == 2 );
+    }
+    node.futureCleanup();
+    AASSERT4( !node.findInfraFuture( id ) );
+    console.log( "testBufferedClosed: OK" );
+}
+
+//A task MAY unschedule another one due in the same batch (such as the flush of a socket it closes, see TcpZeroSocket::close())
+struct TestLoopTask : public InfraLoopTask {
+    LoopContainer* loop = nullptr;
+    TestLoopTask* victim = nullptr;
+    int runs = 0;
+
+    void infraRunLoopTask() override {
+        ++runs;
+        if( victim )
+            loop->infraUnschedule( victim );
+    }
+};
+
+static void testLoopUnschedule() {
+    LoopContainer lc;
+    TestLoopTask a, b;
+    a.loop = b.loop = &lc;
+    a.victim = &b;
+    lc.infraSchedule( &a );
+    lc.infraSchedule( &b );
+    lc.run();
+    AASSERT4( a.runs == 1 && b.runs == 0 );
+    console.log( "testLoopUnschedule: OK" );
+}
+
+//Client writes many small pieces, then a large payload handed over (more than the socket takes at once), then a copied one
+//  larger than a write chunk, all within one handler: server gets all the bytes in order, and they go out as a single batch
+//  (uv_try_write(), then uv_write() for the rest); the large payload is not copied, and receive buffers are not used for writing.
+//  Once the server has closed the connection, the client's writes (of each kind) are dropped
+class NodeWriteBatch : public Node {
+  public:
+    static const size_t LARGE = 16 * 1024 * 1024;
+    static const size_t TAIL = 100 * 1024;
+
+    std::string sent;
+    std::string received;
+    InfraBufferPool* writeBuffers = nullptr;
+    bool closedWrites = false;
+
+    void run() override {
+        auto server = net::createServer( this );
+        auto futureSock = server->listen( 0 );
+        int port = server->port();
+        futureSock.onEach( [ this, server, futureSock ]( const std::exception* ) {
+            TcpSocket sock = futureSock.value();
+            auto futureData = sock.read();
+            futureData.onEach( [ this, server, sock, futureData ]( const std::exception * err ) {
+                if( err )
+                    return;
+                received.append( futureData.value().toString(), futureData.value().size() );
+                if( received.size() >= sent.size() ) {
+                    sock.close();
+                    server->close();
+                    delete server;
+                }
+            } );
+        } );
+
+        for( int i = 0; i < 1000; i++ )
+            sent += std::to_string( i ) + ",";
+        size_t small = sent.size();
+        sent += std::string( LARGE, 'x' );
+        for( size_t i = sent.size() - 1024 * 1024; i < sent.size(); i++ )
+            sent[i] = 'a' + i % 26;
+        for( size_t i = 0; i < TAIL; i++ )
+            sent += char( '0' + i % 10 );
+
+        Future< TcpSocket > futureClient = net::connect( this, "127.0.0.1", port );
+        futureClient.then( [ this, futureClient, small ]( const std::exception * ex ) {
+            AASSERT4( !ex, "NodeWriteBatch: can't connect" );
+            TcpSocket client = futureClient.value();
+            for( size_t pos = 0; pos < small; ) {
+                size_t comma = sent.find( ',', pos );
+                client.write( sent.data() + pos, comma + 1 - pos );
+                pos = comma + 1;
+            }
+            client.write( sent.substr( small, LARGE ) );
+            client.write( sent.data() + small + LARGE, TAIL );
+            auto futureData = client.read();//NB: till the server closes the connection
+            futureData.onEach( [ this, client, futureData ]( const std::exception * err ) {
+                if( !err )
+                    return;
+                client.write( "late", 4 );
+                client.write( std::string( TAIL, 'z' ) );
+                client.write( NetworkBuffer( writeBuffers->allocate( 1 ), InfraBufferPool::classSize( 1 ) ) );
+                closedWrites = true;
+            } );
+        } );
+    }
+};
+
+static void testWriteBatch() {
+    ZeroWriteStats before = net::writeStats();
+    LoopContainer lc;
+    InfraNodeContainer container( &lc );
+    NodeWriteBatch* p = new NodeWriteBatch;
+    p->writeBuffers = &lc.infraWriteBuffers();
+    container.addNode( p );
+    container.run();
+    container.removeNode( p );
+    const ZeroWriteStats& st = net::writeStats();
+    const InfraBufferPool::Stats& recv = lc.infraRecvBuffers().getStats();
+    const InfraBufferPool::Stats& write = lc.infraWriteBuffers().getStats();
+    console.log( "testWriteBatch: {} bytes, {} batches, {} written right away, {} partially, {} uv_write's, {} bytes not copied", st.bytes - before.bytes,
+                 st.flushes - before.flushes, st.tryWritten - before.tryWritten, st.partial - before.partial, st.uvWrites - before.uvWrites,
+                 st.referenced - before.referenced );
+    console.log( "testWriteBatch: write chunks: {} from free lists, {} new slabs, {} fallbacks; receive buffers: {} fallbacks", write.hits, write.misses,
+                 write.fallbacks, recv.fallbacks );
+    AASSERT4( p->received == p->sent, "received {} bytes of {}", p->received.size(), p->sent.size() );
+    AASSERT4( p->closedWrites );
+    AASSERT4( st.flushes - before.flushes == 1 );
+    AASSERT4( st.uvWrites - before.uvWrites <= 1 );
+    AASSERT4( st.referenced - before.referenced == NodeWriteBatch::LARGE );
+    AASSERT4( write.misses > 0 && write.fallbacks == 0 && recv.fallbacks == 0 );
+    delete p;//NB: along with its MultiFuture's, which hold the last bytes received
+    AASSERT4( write.inUse == 0 && recv.inUse == 0, "{} write chunks, {} receive buffers in use", write.inUse, recv.inUse );
+    console.log( "testWriteBatch: OK" );
+}
+
+//Each program completes the future the next one waits for, so a single infraFire() runs all of them:
+//  one after another, from CCode's run queue, rather than each one nested within the previous one
+static void testCascade() {
+    const int N = 100000;
+    NodeBench node;
+    std::vector< Future< int > > fs;
+    fs.reserve( N + 1 );
+    for( int i = 0; i <= N; ++i )
+        fs.emplace_back( &node );
+    int done = 0;
+    int* pdone = &done;
+    const Future< int >* next = fs.data();
+    for( int i = 0; i < N; ++i ) {
+        CCODE {
+            AWAIT( next[i] );
+            ++*pdone;
+            next[i + 1].setValue( i + 1 );
+            next[i + 1].infraGetPtr()->infraFire( nullptr );
+        }
+        ENDCCODE
+    }
+    fs[0].setValue( 0 );
+    fs[0].infraGetPtr()->infraFire( nullptr );
+    AASSERT4( done == N, "{} programs of {} are over", done, N );
+    AASSERT4( fs[N].value() == N );
+    console.log( "testCascade: OK" );
+}
+
+//Move-only callable (C++11 has no init-captures to move a unique_ptr into a lambda)
+struct TestMoveOnly {
+    int* calls;
+    std::unique_ptr< int > one;
+
+    void operator()() const {
+        *calls += *one;
+    }
+};
+
+//clone() of InlineFunction holding a move-only callable throws, whatever AASSERT_LVL is, and leaves the original as it is
+//  (CCATCH handlers, which are cloned, MUST be copyable at compile time, see CTryStep::ccatch())
+static void testCloneMoveOnly() {
+    int calls = 0;
+    InlineFunction< void( void ) > f = TestMoveOnly{ &calls, std::unique_ptr< int >( new int( 1 ) ) };
+    bool thrown = false;
+    try {
+        InlineFunction< void( void ) > g = f.clone();
+    } catch( const std::logic_error& ) {
+        thrown = true;
+    }
+    AASSERT4( thrown );
+    f();
+    AASSERT4( calls == 1 );
+    console.log( "testCloneMoveOnly: OK" );
+}
+
+//Fires f the way Node does it (see Node::infraProcessTimer() and Node::infraProcessTcpClosed())
+static void testFire( const FutureBase& f, const std::exception* ex ) {
+    auto inf = f.infraGetPtr();
+    if( !ex )
+        inf->setDataReady();
+    inf->infraFire( ex );
+    inf->cleanup();
+}
+
+static const ErrorStatus testRefused( ErrorStatus::USER + 1, "refused" );
+
+//SharedFuture calls each of its continuations once, with the same result or error, whether they come before or after it fires;
+//  late ones are not kept, so nothing is left on the Node once the SharedFuture's are gone
+static void testSharedFuture() {
+    NodeBench node;
+    int calls[4] = { 0, 0, 0, 0 };
+    int codes[4] = { -1, -1, -1, -1 };
+    int* pc = calls;
+    int* pcodes = codes;
+    {
+        SharedFuture< int > ok( &node );
+        for( int i = 0; i < 2; i++ ) {
+            ok.then( [ = ]( const std::exception * ex ) {
+                AASSERT4( !ex && ok.value() == 42 );
+                pc[i]++;
+            } );
+        }
+        ok.setValue( 42 );
+        ok.then( [ = ]( const std::exception * ex ) {
+            AASSERT4( !ex && ok.value() == 42 );
+            pc[3]++;
+        } );
+        AASSERT4( calls[3] == 0, "continuation called before the future has fired" );
+        testFire( ok, nullptr );
+        ok.then( [ = ]( const std::exception * ex ) {
+            AASSERT4( !ex && ok.value() == 42 );
+            pc[2]++;
+        } );
+        AASSERT4( calls[0] == 1 && calls[1] == 1 && calls[2] == 1 && calls[3] == 1 );
+    }
+    node.futureCleanup();
+    AASSERT4( node.isEmpty() );
+
+    const ErrorStatus* errors[] = { &ErrorStatus::get( ErrorStatus::CLOSED ), &testRefused };
+    for( const ErrorStatus* err : errors ) {
+        for( int i = 0; i < 4; i++ ) {
+            calls[i] = 0;
+            codes[i] = -1;
+        }
+        {
+            SharedFuture< int > failed( &node );
+            for( int i = 0; i < 2; i++ ) {
+                failed.then( [ = ]( const std::exception * ex ) {
+                    AASSERT4( ex );
+                    pc[i]++;
+                    pcodes[i] = errorCode( *ex );
+                } );
+            }
+            testFire( failed, err );
+            for( int i = 2; i < 4; i++ ) {
+                failed.then( [ = ]( const std::exception * ex ) {
+                    AASSERT4( ex && 0 == strcmp( ex->what(), err->what() ), "late continuation: '{}'", ex ? ex->what() : "" );
+                    pc[i]++;
+                    pcodes[i] = errorCode( *ex );
+                } );
+            }
+        }
+        for( int i = 0; i < 4; i++ )
+            AASSERT4( calls[i] == 1 && codes[i] == err->code(), "continuation {}: {} calls, code {}", i, calls[i], codes[i] );
+        node.futureCleanup();
+        AASSERT4( node.isEmpty(), "failed SharedFuture is still there" );
+    }
+
+    //Exception which is not an ErrorStatus keeps its message (with code 0), even once the exception itself is gone
+    calls[0] = 0;
+    {
+        SharedFuture< int > failed( &node );
+        {
+            std::runtime_error x( std::string( "step failed" ) );
+            testFire( failed, &x );
+        }
+        failed.then( [ = ]( const std::exception * ex ) {
+            AASSERT4( ex && 0 == strcmp( ex->what(), "step failed" ) && 0 == errorCode( *ex ), "late continuation: '{}'", ex ? ex->what() : "" );
+            pc[0]++;
+        } );
+    }
+    AASSERT4( calls[0] == 1 );
+    node.futureCleanup();
+    AASSERT4( node.isEmpty() );
+    console.log( "testSharedFuture: OK" );
+}
+
+//Moved Future takes over the reference, leaving the source empty; a move-assigned one releases the future it had;
+//  setValue( T&& ) and emplace() move the result in, so T MAY be move-only; nothing is left on the Node once the Future's are gone
+static void testFutureMove() {
+    NodeBench node;
+    int calls = 0;
+    int* pc = &calls;
+    {
+        Future< std::string > a( &node );
+        Future< std::string > b( std::move( a ) );
+        AASSERT4( !a.infraGetPtr() && b.infraGetPtr() && b.infraGetPtr()->refCount == 1 );
+        Future< std::string > c( &node );
+        c = std::move( b );
+        AASSERT4( !b.infraGetPtr() && c.infraGetPtr()->refCount == 1 );
+        c.then( [ = ]( const std::exception * ex ) {
+            AASSERT4( !ex && c.value() == std::string( 100, 'x' ) );
+            ( *pc )++;
+        } );
+        std::string s( 100, 'x' );
+        const char* bytes = s.data();
+        c.setValue( std::move( s ) );
+        AASSERT4( c.value().data() == bytes, "setValue( T&& ) has copied the result" );
+        testFire( c, nullptr );
+        bool thrown = false;
+        try {
+            a.value();
+        } catch( const AssertionError& ) {
+            thrown = true;
+        }
+        AASSERT4( thrown );
+    }
+    AASSERT4( calls == 1 );
+    node.futureCleanup();
+    AASSERT4( node.isEmpty(), "moved Future is still there" );
+
+    {
+        Future< std::unique_ptr< int > > p( &node );
+        p.then( [ = ]( const std::exception * ex ) {
+            AASSERT4( !ex && *p.value() == 7 );
+            ( *pc )++;
+        } );
+        p.emplace( new int( 7 ) );
+        testFire( p, nullptr );
+        Future< std::unique_ptr< int > > q( &node );
+        q.setValue( std::unique_ptr< int >( new int( 8 ) ) );
+        Future< std::unique_ptr< int > > r;
+        r = std::move( q );
+        AASSERT4( !q.infraGetPtr() && *r.value() == 8 );
+    }
+    AASSERT4( calls == 2 );
+    node.futureCleanup();
+    AASSERT4( node.isEmpty(), "Future of a move-only result is still there" );
+    console.log( "testFutureMove: OK" );
+}
+
+//whenAll()/whenAny() over futures which are ready, pending or failed, in any order; then() of the result is called exactly once,
+//  even if it is over by the time whenAll()/whenAny() returns; nothing is left on the Node afterwards
+static void testWhen() {
+    NodeBench node;
+    size_t results[8];
+    int codes[8];
+    int calls[8];
+    for( int i = 0; i < 8; i++ ) {
+        results[i] = 1000;
+        codes[i] = -1;
+        calls[i] = 0;
+    }
+    size_t* pr = results;
+    int* pcodes = codes;
+    int* pc = calls;
+    auto expect = [ = ]( const Future< size_t >& f, int i ) {
+        f.then( [ = ]( const std::exception * ex ) {
+            pc[i]++;
+            if( ex )
+                pcodes[i] = errorCode( *ex );
+            else
+                pr[i] = f.value();
+        } );
+    };
+    {
+        Future< int > a( &node ), b( &node ), c( &node ), d( &node ), e( &node ), h( &node ), failed( &node );
+        a.setValue( 1 );
+        testFire( a, nullptr );
+        b.setValue( 2 );
+        testFire( b, nullptr );
+        testFire( failed, &ErrorStatus::get( ErrorStatus::CLOSED ) );
+
+        expect( whenAll( a, b ), 0 );//all of them are ready
+        expect( whenAny( c, b ), 1 );//one of them is ready
+        expect( whenAll( c, failed ), 2 );//one of them has failed
+        AASSERT4( calls[0] == 1 && results[0] == 2 );
+        AASSERT4( calls[1] == 1 && results[1] == 1 );
+        AASSERT4( calls[2] == 1 && codes[2] == ErrorStatus::CLOSED );
+
+        expect( whenAll( c, d ), 3 );
+        expect( whenAny( &node, std::vector< Future< int > > { e, h } ), 4 );
+        d.setValue( 4 );
+        testFire( d, nullptr );
+        AASSERT4( calls[3] == 0 );
+        h.setValue( 6 );
+        testFire( h, nullptr );
+        c.setValue( 3 );
+        testFire( c, nullptr );
+        AASSERT4( calls[3] == 1 && results[3] == 2 );
+        AASSERT4( calls[4] == 1 && results[4] == 1 );
+
+        Future< int > f( &node ), g( &node );
+        expect( whenAll( f, g ), 5 );
+        testFire( g, &ErrorStatus::get( ErrorStatus::RESET ) );
+        AASSERT4( calls[5] == 1 && codes[5] == ErrorStatus::RESET );
+        f.setValue( 5 );
+        testFire( f, nullptr );//NB: not a member anymore
+        AASSERT4( calls[5] == 1 );
+
+        expect( whenAll( &node, std::vector< Future< int > >() ), 6 );
+        AASSERT4( calls[6] == 1 && results[6] == 0 );
+        bool thrown = false;
+        try {
+            whenAny( &node, std::vector< Future< int > >() );
+        } catch( const std::invalid_argument& ) {
+            thrown = true;
+        }
+        AASSERT4( thrown );
+        thrown = false;
+        try {
+            whenAll( Future< int >(), f );
+        } catch( const AssertionError& ) {
+            thrown = true;
+        }
+        AASSERT4( thrown );
+
+        //AWAIT_ALL of a failed future goes to CCATCH, rather than waiting forever
+        CCODE {
+            TTRY {
+                AWAIT_ALL( e, failed );
+                pc[7] = -1000;
+            }
+            CCATCH( const std::exception & x ) {
+                pc[7]++;
+                pcodes[7] = errorCode( x );
+            }
+            ENDTTRY
+        }
+        ENDCCODE
+        AASSERT4( calls[7] == 1 && codes[7] == ErrorStatus::CLOSED );
+    }
+    node.futureCleanup();
+    AASSERT4( node.isEmpty() );
+    console.log( "testWhen: OK" );
+}
+
+//Branches of PPARALLEL run until they wait, and the step after ENDPPARALLEL comes once all of them are over, in whatever order;
+//  a branch which fails goes to CCATCH of TTRY around PPARALLEL right away, but doesn't stop the others,
+//  and the step after ENDTTRY comes once they are over too;
+//  all the WAITs have released their futures by the time the program is over
+static void testParallel() {
+    NodeBench node;
+    std::string log;
+    std::string* plog = &log;
+    {
+        Future<int> a( &node ), b( &node ), c( &node ), d( &node ), e( &node ), f( &node ), g( &node ), h( &node );
+        CCODE {
+            AWAIT_ALL( a, b );
+            *plog += "1";
+            PPARALLEL {
+                AWAIT( c );
+                *plog += "A";
+            }
+            AAND {
+                *plog += "B";
+            }
+            AAND {
+                AWAIT( d );
+                *plog += "C";
+            }
+            ENDPPARALLEL
+            *plog += "j";
+            TTRY {
+                PPARALLEL {
+                    AWAIT( e );
+                    *plog += "D";
+                }
+                AAND {
+                    AWAIT( f );
+                    throw std::runtime_error( "E" );
+                }
+                ENDPPARALLEL
+                *plog += "NOT REACHED";
+            }
+            CCATCH( const std::exception & x ) {
+                *plog += "x";
+                *plog += x.what();
+            }
+            ENDTTRY
+            AWAIT_ANY( g, h );
+            *plog += "z";
+        }
+        ENDCCODE
+        const Future<int>* order[] = { &b, &a, &d, &c, &f, &e, &h, &g };
+        const char* expected[] = { "", "1B", "1BC", "1BCAj", "1BCAjxE", "1BCAjxED", "1BCAjxEDz", "1BCAjxEDz" };
+        for( int i = 0; i < 8; i++ ) {
+            order[i]->setValue( i );
+            testFire( *order[i], nullptr );
+            AASSERT4( log == expected[i], "after firing #{}: '{}'", i, log );
+        }
+    }
+    node.futureCleanup();
+    AASSERT4( node.isEmpty(), "futures left after PPARALLEL" );
+    console.log( "testParallel: OK" );
+}
+
+//NodeServer5's program, with its log kept instead of printed; futures are completed by the caller (see testEngines())
+struct Server5State {
+    std::string log;
+    int loops = 0;
+};
+
+//The same body for each engine which runs CCODE macros (NB: ACCODE_ENGINE is a template parameter here)
+template< typename Engine >
+static void server5Program( Node* node, const Future<Timer>* d, Server5State* st ) {
+#undef ACCODE_ENGINE
+#define ACCODE_ENGINE Engine
+    Future<Timer> data( d[0] ), data2( d[1] ), data3( d[2] ), data4( d[3] ), data5( d[4] );
+    Future<bool> cond( node );
+    CCODE {
+        TTRY {
+            AWAIT( data );
+            st->log += "1";
+            cond.setValue( true );
+            WWHILE( cond ) {
+                st->log += "w";
+                if( ++st->loops > 10 )
+                    cond.setValue( false );
+            }
+            ENDWWHILE
+            IIF( cond ) {
+                st->log += "+";
+                AWAIT( data2 );
+                st->log += "2";
+            }
+            EELSE {
+                TTRY {
+                    st->log += "-";
+                    cond.setValue( true );
+                    AWAIT( data3 );
+                }
+                CCATCH( const std::exception & x ) {
+                    st->log += "c";
+                }
+                ENDTTRY
+                st->log += "3";
+            }
+            ENDIIF
+            IIF( cond ) {
+                st->log += "+";
+                AWAIT( data4 );
+                st->log += "4";
+            }
+            EELSE {
+                st->log += "-";
+                AWAIT( data5 );
+                st->log += "5";
+            }
+            ENDIIF
+        }
+        CCATCH( const std::exception & x ) {
+            st->log += "o";
+        }
+        ENDTTRY
+    }
+    ENDCCODE
+#undef ACCODE_ENGINE
+#define ACCODE_ENGINE CCode
+}
+
+#ifdef ACORO_ENABLED
+//The same program as a coroutine
+static CoTask server5Coro( Node*, const Future<Timer>* d, Server5State* st ) {
+    Future<Timer> data( d[0] ), data2( d[1] ), data3( d[2] ), data4( d[3] ), data5( d[4] );
+    try {
+        co_await data;
+        st->log += "1";
+        bool cond = true;
+        while( cond ) {
+            st->log += "w";
+            if( ++st->loops > 10 )
+                cond = false;
+        }
+        if( cond ) {
+            st->log += "+";
+            co_await data2;
+            st->log += "2";
+        } else {
+            try {
+                st->log += "-";
+                cond = true;
+                co_await data3;
+            } catch( const std::exception& x ) {
+                st->log += "c";
+            }
+            st->log += "3";
+        }
+        if( cond ) {
+            st->log += "+";
+            co_await data4;
+            st->log += "4";
+        } else {
+            st->log += "-";
+            co_await data5;
+            st->log += "5";
+        }
+    } catch( const std::exception& x ) {
+        st->log += "o";
+    }
+}
+#endif
+
+//Runs program once per scenario: futures are completed in order, failed ones with testRefused;
+//  each scenario ends with the expected log, and with nothing left on the Node
+template< typename Program >
+static void testEngine( const char* engine, Program program ) {
+    struct Scenario {
+        std::initializer_list< int > order;
+        int failing;
+        const char* log;
+    };
+    const Scenario scenarios[] = {
+        { { 0, 2, 3 }, -1, "1wwwwwwwwwww-3+4" },
+        { { 0, 2, 3 }, 2, "1wwwwwwwwwww-c3+4" },//nested TTRY
+        { { 0, 2, 3 }, 3, "1wwwwwwwwwww-3+o" },//outer TTRY
+        { { 1, 4, 2, 0, 3 }, -1, "1wwwwwwwwwww-3+4" },//NB: the ones which are not awaited don't matter
+        { { 2, 0, 3 }, 2, "1wwwwwwwwwww-c3+4" },//fails before it is awaited
+        { { 3, 0, 2 }, 3, "1wwwwwwwwwww-3+o" },
+        { { 0 }, 0, "o" },
+    };
+    for( const Scenario& sc : scenarios ) {
+        NodeBench node;
+        Server5State st;
+        {
+            Future<Timer> d[5] = { Future<Timer>( &node ), Future<Timer>( &node ), Future<Timer>( &node ), Future<Timer>( &node ), Future<Timer>( &node ) };
+            program( &node, d, &st );
+            for( int k : sc.order )
+                testFire( d[k], k == sc.failing ? &testRefused : nullptr );
+        }
+        node.futureCleanup();
+        AASSERT4( st.log == sc.log, "{}: log '{}' instead of '{}'", engine, st.log, sc.log );
+        AASSERT4( node.isEmpty(), "{}: futures left on the Node", engine );
+    }
+}
+
+static void testEngines() {
+    testEngine( "CCode", server5Program< CCode > );
+    testEngine( "CFlatCode", server5Program< CFlatCode > );
+    testEngine( "CStaticCode", server5Program< CStaticCode > );
+#ifdef ACORO_ENABLED
+    testEngine( "coroutine", server5Coro );
+#endif
+    console.log( "testEngines: OK" );
+}
+
+//Frame of testCodeProgram(): the same shape as NodeServer9Conn, with ticks completed by the test
+struct TestConn {
+    int id;
+    const Future<Timer>* ticks;
+    std::string* log;
+    int n = 0;
+    Future<Timer> t;
+    Future<bool> more;
+
+    TestConn( Node* node, int id_, const Future<Timer>* ticks_, std::string* log_ ) : id( id_ ), ticks( ticks_ ), log( log_ ), more( node ) {}
+};
+
+//One CCodeProgram started for a few frames at once: each one runs on its own, and its frame is gone once it is over
+static void testCodeProgram() {
+    using Program = CCodeProgram< TestConn >;
+    static const Program program(
+    []( TestConn & c ) {
+        c.more.setValue( true );
+    },
+    Program::wwhile( &TestConn::more,
+    []( TestConn & c ) {
+        c.t = c.ticks[c.n];
+    },
+    Program::waitFor( &TestConn::t ),
+    []( TestConn & c ) {
+        *c.log += fmt::format( "{}t", c.id );
+        c.more.setValue( ++c.n < 2 );
+    } ),
+    Program::ttry(
+    []( TestConn & c ) {
+        if( c.id == 2 )
+            throw std::runtime_error( "conn 2 failed" );
+    } ).ccatch( []( TestConn & c, const std::exception & x ) {
+        *c.log += fmt::format( "{}c", c.id );
+    } ),
+    []( TestConn & c ) {
+        *c.log += fmt::format( "{}d", c.id );
+    } );
+
+    NodeBench node;
+    std::string log;
+    {
+        Future<Timer> ticks[3][2] = {
+            { Future<Timer>( &node ), Future<Timer>( &node ) },
+            { Future<Timer>( &node ), Future<Timer>( &node ) },
+            { Future<Timer>( &node ), Future<Timer>( &node ) },
+        };
+        for( int i = 0; i < 3; i++ )
+            program.start( &node, i + 1, ticks[i], &log );
+        testFire( ticks[1][0], nullptr );
+        testFire( ticks[0][0], nullptr );
+        testFire( ticks[1][1], nullptr );
+        testFire( ticks[2][0], nullptr );
+        testFire( ticks[2][1], &testRefused );//NB: no TTRY around WAIT, so conn 3 is just over
+        testFire( ticks[0][1], nullptr );
+    }
+    node.futureCleanup();
+    AASSERT4( log == "2t1t2t2c2d3t1t1d", "log '{}'", log );
+    AASSERT4( node.isEmpty() );
+    console.log( "testCodeProgram: OK" );
+}
+
+//AWAIT_FOR fails with ErrorStatus::TIMEOUT once its deadline is over, and closes its deadline timer when its future is in time;
+//  CancelToken tears down the WAITs of a program right away, releasing their futures; all of it on short (ms) timers
+class NodeDeadlines : public Node {
+    CancelToken token;
+    ZeroTimeout quickTimer, tickTimer;
+
+  public:
+    std::string log;
+    int timeoutCode = 0;
+    bool cancelled = false;
+    FutureId stuckIds[2] = { 0, 0 };
+
+    void run() override {
+        startDeadlines();
+        startStuck();
+        startCanceller();
+    }
+
+  private:
+    void startDeadlines() {
+        Future<Timer> never( this ), quick( this );
+        CCODE {
+            TTRY {
+                AWAIT_FOR( never, 20 );
+                log += "NOT REACHED";
+            }
+            CCATCH( const std::exception & x ) {
+                log += "t";
+                timeoutCode = errorCode( x );
+            }
+            ENDTTRY
+            quickTimer = startTimeoutMs( quick, this, 10 );
+            TTRY {
+                AWAIT_FOR( quick, 5000 );//NB: if its timer stays open, the loop won't be over
+                log += "q";
+            }
+            CCATCH( const std::exception & x ) {
+                log += "NOT REACHED";
+            }
+            ENDTTRY
+            cancelTimeout( quickTimer );
+        }
+        ENDCCODE
+    }
+
+    void startStuck() {
+        Future<Timer> stuck1( this ), stuck2( this );//NB: never started
+        stuckIds[0] = stuck1.infraGetId();
+        stuckIds[1] = stuck2.infraGetId();
+        CCODE_WITH( token ) {
+            PPARALLEL {
+                AWAIT( stuck1 );
+                log += "NOT REACHED";
+            }
+            AAND {
+                AWAIT( stuck2 );
+                log += "NOT REACHED";
+            }
+            ENDPPARALLEL
+            log += "NOT REACHED";
+        }
+        ENDCCODE
+    }
+
+    void startCanceller() {
+        Future<Timer> tick( this );
+        tickTimer = startTimeoutMs( tick, this, 30 );
+        CCODE {
+            AWAIT( tick );
+            cancelTimeout( tickTimer );
+            token.cancel();
+            cancelled = true;
+        }
+        ENDCCODE
+    }
+};
+
+static void testDeadlines() {
+    LoopContainer lc;
+    InfraNodeContainer container( &lc );
+    NodeDeadlines* p = new NodeDeadlines;
+    auto start = std::chrono::steady_clock::now();
+    container.addNode( p );
+    container.run();
+    std::chrono::duration< double > elapsed = std::chrono::steady_clock::now() - start;
+    p->futureCleanup();
+    AASSERT4( p->log == "tq", "log '{}'", p->log );
+    AASSERT4( p->cancelled );
+    AASSERT4( p->timeoutCode == ErrorStatus::TIMEOUT, "code {}", p->timeoutCode );
+    AASSERT4( !p->findInfraFuture( p->stuckIds[0] ) && !p->findInfraFuture( p->stuckIds[1] ), "cancelled WAITs still hold their futures" );
+    AASSERT4( elapsed.count() < 2, "{} sec", elapsed.count() );
+    container.removeNode( p );//NB: checks that there are no futures left
+    delete p;
+    console.log( "testDeadlines: OK" );
+}
+
+//CCATCH gets the very ErrorStatus which has failed the step, whichever way it comes:
+//  from fail() (with a temporary), from AWAIT_FOR deadline, and from a socket closed by the peer
+class NodeErrorCodes : public Node {
+  public:
+    std::vector< int > codes;
+
+    void run() override {
+        TcpServer* server = net::createServer( this );
+        auto accepted = server->listen( 0 );
+        accepted.onEach( [ server, accepted ]( const std::exception * ex ) {
+            if( ex )
+                return;
+            accepted.value().close();
+            server->close();
+            delete server;
+        } );
+        Future< TcpSocket > client = net::connect( this, "127.0.0.1", server->port() );
+        Future< Timer > never( this );
+        CCODE {
+            TTRY {
+                CCode::fail( ErrorStatus( ErrorStatus::USER + 2, "given up" ) );
+            }
+            CCATCH( const std::exception & x ) {
+                codes.push_back( errorCode( x ) );
+            }
+            ENDTTRY
+            TTRY {
+                AWAIT_FOR( never, 10 );
+            }
+            CCATCH( const std::exception & x ) {
+                codes.push_back( errorCode( x ) );
+            }
+            ENDTTRY
+            AWAIT( client );
+            readClosed( client.value() );
+        }
+        ENDCCODE
+    }
+
+  private:
+    void readClosed( TcpSocket sock ) {
+        //NB: CCode waits for Future's only, so the end of the stream comes through one
+        Future< Buffer > closed( this );
+        auto data = sock.read();
+        data.onEach( [ closed ]( const std::exception * ex ) {
+            if( !ex )
+                return;
+            closed.infraGetPtr()->infraFire( ex );
+            closed.infraGetPtr()->cleanup();
+        } );
+        CCODE {
+            TTRY {
+                AWAIT( closed );
+                codes.push_back( -1 );
+            }
+            CCATCH( const std::exception & x ) {
+                codes.push_back( errorCode( x ) );
+            }
+            ENDTTRY
+            sock.close();
+        }
+        ENDCCODE
+    }
+};
+
+static void testErrorCodes() {
+    LoopContainer lc;
+    InfraNodeContainer container( &lc );
+    NodeErrorCodes* p = new NodeErrorCodes;
+    container.addNode( p );
+    container.run();
+    p->futureCleanup();
+    AASSERT4( p->codes == std::vector< int >( { ErrorStatus::USER + 2, ErrorStatus::TIMEOUT, ErrorStatus::CLOSED } ), "{} codes", p->codes.size() );
+    container.removeNode( p );
+    delete p;
+    console.log( "testErrorCodes: OK" );
+}
+
+#ifdef ACCODE_PROFILING
+//Profiler counts each run of a step at its site, with CPU time of the thread (so a step which sleeps costs next to nothing there),
+//  and each WAIT at its AWAIT, with the wall time it has waited
+static void testProfileCounts() {
+    StepSite::reset();
+    NodeBench node;
+    Future< int > f( &node );
+    Future< bool > cond( &node );
+    int n = 0;
+    int* pn = &n;
+    const int at = __LINE__;
+    CCODE {
+        cond.setValue( true );
+        WWHILE( cond ) {
+            if( ++*pn == 3 )
+                cond.setValue( false );
+        }
+        ENDWWHILE
+        AWAIT( f );
+        std::this_thread::sleep_for( std::chrono::milliseconds( 50 ) );
+    }
+    ENDCCODE
+    std::this_thread::sleep_for( std::chrono::milliseconds( 20 ) );
+    f.setValue( 1 );
+    f.infraGetPtr()->infraFire( nullptr );
+    AASSERT4( n == 3 );
+
+    const StepSite* first = StepSite::find( __FILE__, at + 1, 'E' );
+    const StepSite* body = StepSite::find( __FILE__, at + 3, 'E' );
+    const StepSite* loop = StepSite::find( __FILE__, at + 3, 'L' );
+    const StepSite* after = StepSite::find( __FILE__, at + 7, 'E' );
+    const StepSite* wait = StepSite::find( __FILE__, at + 8, 'W' );
+    const StepSite* sleep = StepSite::find( __FILE__, at + 8, 'E' );
+    AASSERT4( first && body && loop && after && wait && sleep );
+    AASSERT4( body->program == first && loop->program == first && wait->program == first && sleep->program == first );
+    AASSERT4( first->run.count == 1 && after->run.count == 1 && sleep->run.count == 1 );
+    AASSERT4( body->run.count == 3, "{} runs of the loop body", body->run.count );
+    AASSERT4( loop->run.count == 4, "{} checks of the loop condition", loop->run.count );
+    AASSERT4( wait->wait.count == 1 && wait->wait.total >= 20000000, "{} waits, {}ns", wait->wait.count, wait->wait.total );
+    AASSERT4( sleep->run.total < 25000000, "{}ns of CPU time in a step which sleeps for 50ms", sleep->run.total );
+    console.log( "testProfileCounts: OK" );
+}
+#endif
+
+struct TestFlatFrame {
+    Future<bool> cond;//never ready, so that IIF/WWHILE on it throw
+    std::string* log;
+
+    TestFlatFrame( Node* node, std::string* log_ ) : cond( node ), log( log_ ) {}
+    ~TestFlatFrame() {
+        *log += "~";
+    }
+};
+using TestFlatProgram = CCodeProgram< TestFlatFrame >;
+
+//Exceptions from IIF/WWHILE conditions and from CCATCH handlers go to the enclosing TTRY, same as the ones from steps;
+//  with no TTRY to handle them, the program just ends (and its Run is gone), nothing escapes start()
+static void testFlatExceptions() {
+    NodeBench node;
+    std::string log;
+    static const TestFlatProgram condInTry(
+        TestFlatProgram::ttry(
+            TestFlatProgram::iif( &TestFlatFrame::cond,
+    []( TestFlatFrame & f ) {
+        *f.log += "NOT REACHED";
+    } ) ).ccatch( []( TestFlatFrame & f, const std::exception & ) {
+        *f.log += "c";
+    } ),
+    []( TestFlatFrame & f ) {
+        *f.log += "a";
+    } );
+    condInTry.start( &node, &log );
+    AASSERT4( log == "ca~", "condition in TTRY: '{}'", log );
+
+    log.clear();
+    static const TestFlatProgram handlerThrows(
+        TestFlatProgram::ttry(
+            TestFlatProgram::ttry(
+    []( TestFlatFrame & ) {
+        throw std::runtime_error( "step" );
+    } ).ccatch( []( TestFlatFrame & f, const std::exception & x ) {
+        *f.log += "i";
+        throw std::runtime_error( std::string( "handler of " ) + x.what() );
+    } ),
+    []( TestFlatFrame & f ) {
+        *f.log += "NOT REACHED";
+    } ).ccatch( []( TestFlatFrame & f, const std::exception & x ) {
+        *f.log += x.what() == std::string( "handler of step" ) ? "o" : "?";
+    } ),
+    []( TestFlatFrame & f ) {
+        *f.log += "a";
+    } );
+    handlerThrows.start( &node, &log );
+    AASSERT4( log == "ioa~", "handler in TTRY: '{}'", log );
+
+    log.clear();
+    static const TestFlatProgram unhandled(
+        TestFlatProgram::wwhile( &TestFlatFrame::cond,
+    []( TestFlatFrame & f ) {
+        *f.log += "NOT REACHED";
+    } ) );
+    unhandled.start( &node, &log );
+    AASSERT4( log == "~", "unhandled condition: '{}'", log );
+
+    log.clear();
+    static const TestFlatProgram unhandledHandler(
+        TestFlatProgram::ttry(
+    []( TestFlatFrame & ) {
+        throw std::runtime_error( "step" );
+    } ).ccatch( []( TestFlatFrame & f, const std::exception & ) {
+        *f.log += "c";
+        throw std::runtime_error( "handler" );
+    } ),
+    []( TestFlatFrame & f ) {
+        *f.log += "NOT REACHED";
+    } );
+    unhandledHandler.start( &node, &log );
+    AASSERT4( log == "c~", "unhandled handler: '{}'", log );
+    console.log( "testFlatExceptions: OK" );
+}
+
+//Checks of the infrastructure
+static void runTests() {
+    testClosedEvent();
+    testBufferedOverflow();
+    testBufferedClosed();
+    testLoopUnschedule();
+    testCascade();
+    testCloneMoveOnly();
+    testSharedFuture();
+    testFutureMove();
+    testWhen();
+    testParallel();
+    testFlatExceptions();
+    testEngines();
+    testCodeProgram();
+    testDeadlines();
+    testErrorCodes();
+#ifdef ACCODE_PROFILING
+    testProfileCounts();
+#endif
+    testWriteBatch();
+}
+
 static void testServerZero() {
     LoopContainer loop;
     auto p = new ZeroServer0;
@@ -427,6 +2151,20 @@ static void testServer() {
     delete p;
 }
 
+//Runs a few of the servers above, and reports where their CCode steps spend time (needs ACCODE_PROFILING)
+static void testProfile() {
+    LoopContainer lc;
+    InfraNodeContainer container( &lc );
+    Node* servers[] = { new NodeServer5, new NodeServer11, new NodeServer12 };
+    for( Node* p : servers ) {
+        container.addNode( p );
+        container.run();
+        container.removeNode( p );
+        delete p;
+    }
+    StepSite::report();
+}
+
 static void testClient() {
     LoopContainer lc;
     InfraNodeContainer container( &lc );
@@ -437,12 +2175,27 @@ static void testClient() {
         container.removeNode( p );
         delete p;
     }
+    const InfraBufferPool::Stats& recv = lc.infraRecvBuffers().getStats();
+    console.log( "receive buffers: {} from free lists, {} new slabs ({} bytes), {} fallbacks, {} in use", recv.hits, recv.misses,
+                 recv.slabBytes, recv.fallbacks, recv.inUse );
 }
 
 int main( int argc, const char** argv ) {
     try {
         if( argc > 1 && 0 == strcmp( argv[1], "-c" ) )
             testClient();
+        else if( argc > 1 && 0 == strcmp( argv[1], "-t" ) )
+            runTests();
+        else if( argc > 1 && 0 == strcmp( argv[1], "-p" ) )
+            testProfile();
+        else if( argc > 1 && 0 == strcmp( argv[1], "-b" ) ) {
+            benchFuture();
+            benchCCode();
+            benchWhile();
+#ifdef ACORO_ENABLED
+            benchCoro();
+#endif
+        }
         else
             testServer();
     } catch( const std::exception& e ) {